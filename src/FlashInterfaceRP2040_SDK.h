@@ -25,6 +25,7 @@
 #include <math.h>
 #include <hardware/flash.h>
 #include <hardware/sync.h>
+#include <hardware/structs/xip_ctrl.h>
 #include <pico/stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -39,6 +40,12 @@ public:
     virtual ~FlashInterfaceRP2040_SDK() override {
     }
 
+    // the drive region is only known once drivemap_init() has run
+    void setRegion(const uint8_t *start, const uint8_t *end) {
+        _flashSize = end - start;
+        _flash = start;
+    }
+
     virtual int size() override {
         return _flashSize;
     }
@@ -49,7 +56,12 @@ public:
     }
 
     virtual const uint8_t *readEB(int eb) override {
+#ifdef USE_XIP_CACHE_AS_RAM
+        // through the alias that never allocates in the cache, which holds the lower ROM
+        return &_flash[eb * ebBytes] - XIP_BASE + XIP_NOCACHE_NOALLOC_BASE;
+#else
         return &_flash[eb * ebBytes];
+#endif
     }
 
     virtual bool eraseBlock(int eb) override {
@@ -57,7 +69,9 @@ public:
             const uint8_t *addr = _flash + (eb * ebBytes);
             uint32_t ints = save_and_disable_interrupts();
             flash_range_erase((intptr_t)addr - (intptr_t)XIP_BASE, ebBytes);
+            cacheOff();
             restore_interrupts(ints);
+            erases++;
             return true;
         }
         return false;
@@ -68,7 +82,9 @@ public:
             const uint8_t *addr = _flash + (eb * ebBytes + offset);
             uint32_t ints = save_and_disable_interrupts();
             flash_range_program((intptr_t)addr - (intptr_t)XIP_BASE, (const uint8_t *)data, size);
+            cacheOff();
             restore_interrupts(ints);
+            programBytes += size;
             return true;
         }
         return false;
@@ -76,13 +92,56 @@ public:
 
     virtual bool read(int eb, int offset, void *data, int size) override {
         if (eb < _flashSize / ebBytes) {
+#ifdef USE_XIP_CACHE_AS_RAM
+            streamRead(_flash + (eb * ebBytes + offset), (uint8_t *)data, size);
+#else
             memcpy(data, _flash + (eb * ebBytes + offset), size);
+#endif
             return true;
         }
         return false;
     }
 
+    // for FTL.TXT
+    uint32_t erases = 0;
+    uint32_t programBytes = 0;
+
 private:
+    // The boot ROM turns the XIP cache back on at the end of every erase and program. Cached
+    // flash reads would then overwrite the lower ROM in the cache SRAM, so it goes straight
+    // back off, before anything else can run.
+    static inline void cacheOff() {
+#ifdef USE_XIP_CACHE_AS_RAM
+        hw_clear_bits(&xip_ctrl_hw->ctrl, XIP_CTRL_EN_BITS);
+#endif
+    }
+
+#ifdef USE_XIP_CACHE_AS_RAM
+    // With the cache disabled, a plain read holds the XIP bus until the flash answers,
+    // stalling the bus loop's lower ROM reads. The stream FIFO reads flash in the background.
+    static void streamRead(const uint8_t *src, uint8_t *dst, int size) {
+        uint32_t skip = (uint32_t)src & 3;
+        uint32_t words = (skip + size + 3) / 4;
+        while (!(xip_ctrl_hw->stat & XIP_STAT_FIFO_EMPTY_BITS)) {
+            (void)xip_ctrl_hw->stream_fifo;
+        }
+        xip_ctrl_hw->stream_addr = (uint32_t)src & ~3u;
+        xip_ctrl_hw->stream_ctr = words;
+        for (uint32_t i = 0; i < words; i++) {
+            while (xip_ctrl_hw->stat & XIP_STAT_FIFO_EMPTY_BITS) {
+                tight_loop_contents();
+            }
+            uint32_t w = xip_ctrl_hw->stream_fifo;
+            for (uint32_t b = 0; b < 4; b++) {
+                int pos = (int)(i * 4 + b) - (int)skip;
+                if (pos >= 0 && pos < size) {
+                    dst[pos] = w >> (8 * b);
+                }
+            }
+        }
+    }
+#endif
+
     const int ebBytes = 4096;
     int _flashSize;
     const uint8_t *_flash;
@@ -0,0 +1,56 @@
+// Boot report
+// Each mark is the time since power up at which a phase finished, so the report shows both
+// the total and where it went. Marks are taken on core 0 only, before the CPC is let out of
+// reset, and only the first boot is kept.
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "boottime.h"
+
+typedef struct {
+    uint32_t us;
+    char name[BOOT_NAME_LEN];
+} boot_mark_t;
+
+static boot_mark_t marks[BOOT_MAX_MARKS];
+static int num_marks;
+static bool finished;
+
+void boot_mark(const char *what, const char *detail) {
+    if (finished || num_marks == BOOT_MAX_MARKS) return;
+    boot_mark_t *m = &marks[num_marks++];
+    m->us = time_us_32();
+    if (detail) {
+        // the file name says more than the start of its path
+        const char *name = strrchr(detail, '/');
+        snprintf(m->name, sizeof(m->name), "%s %s", what, name ? name + 1 : detail);
+    } else {
+        snprintf(m->name, sizeof(m->name), "%s", what);
+    }
+}
+
+void boot_finish(const char *what) {
+    // keep a slot for the end of the boot
+    if (num_marks == BOOT_MAX_MARKS) num_marks--;
+    boot_mark(what, NULL);
+    finished = true;
+}
+
+// ms since power up, then ms since the previous mark, fits a 40 column screen
+bool boot_line(int i, char *buf, int size) {
+    if (i >= num_marks) return false;
+    uint32_t us = marks[i].us;
+    uint32_t delta = us - (i ? marks[i - 1].us : 0);
+    snprintf(buf, size, "%4u.%03u +%4u.%03u %s", us / 1000, us % 1000, delta / 1000, delta % 1000, marks[i].name);
+    return true;
+}
+
+int boot_text(char *buf, int size) {
+    int len = snprintf(buf, size, "      ms       +ms phase\r\n");
+    for (int i=0;i<num_marks && len < size;i++) {
+        boot_line(i, buf + len, size - len);
+        len += strlen(buf + len);
+        if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    }
+    return len < size ? len : size - 1;
+}
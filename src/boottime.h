@@ -0,0 +1,26 @@
+#ifndef _BOOTTIME_H_
+#define _BOOTTIME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Boot report: when each start up phase (detect, FTL start, mount, each ROM load, reset
+// release) finished, shown by |PBOOT and in BOOT.TXT on the live drive
+#define BOOT_MAX_MARKS  24
+#define BOOT_NAME_LEN   21
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// a phase has just finished, detail (e.g. a path) is added after what
+void boot_mark(const char *what, const char *detail);
+// the last mark, later calls are ignored so reloads while the CPC runs stay out of the report
+void boot_finish(const char *what);
+// line i of the report, false past the end
+bool boot_line(int i, char *buf, int size);
+// the whole report, for the stats registry
+int boot_text(char *buf, int size);
+#ifdef __cplusplus
+}
+#endif
+#endif
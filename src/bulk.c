@@ -0,0 +1,132 @@
+// Vendor bulk interface for ROM uploads
+// MSC goes through SCSI, FAT and the FTL and CDC through the byte at a time command handler,
+// this interface just moves data. The PC sends a header of "PB", the op, the bank, the length
+// and the CRC32 of the data (little endian), then the data, and reads an 8 byte reply of "PB",
+// the op, the status and the CRC32 the Pico worked out. Load data is read from the endpoint
+// FIFO straight into the RAM main.c gives with bulk_receive.
+#include <string.h>
+#include <pico/stdlib.h>
+#include <tusb.h>
+#include "picorom.h"
+#include "bulk.h"
+
+#define STATE_HEADER    0
+#define STATE_LOAD      1
+#define STATE_DISCARD   2   // load refused, the data is read and dropped
+#define STATE_LOOPBACK  3
+#define STATE_WAIT      4   // load header given to main.c, waiting for bulk_receive
+
+static int state = STATE_HEADER;
+static uint8_t header[BULK_HEADER_SIZE];
+static uint32_t have;
+static uint8_t op;
+static uint32_t length;
+static uint32_t received;
+static uint8_t *dest;
+static uint32_t last_ms;
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void bulk_reply(uint8_t status, uint32_t crc) {
+    uint8_t reply[BULK_REPLY_SIZE] = { 'P', 'B', op, status, crc, crc >> 8, crc >> 16, crc >> 24 };
+    uint32_t start = to_ms_since_boot(get_absolute_time());
+    // the end of a loopback may still be in the FIFO. A PC that doesn't read doesn't get one
+    while (tud_vendor_write_available() < sizeof(reply)) {
+        tud_task();
+        if (!tud_vendor_mounted() || to_ms_since_boot(get_absolute_time()) - start >= BULK_TIMEOUT_MS) return;
+    }
+    tud_vendor_write(reply, sizeof(reply));
+#if TUSB_VERSION_MAJOR > 0 || TUSB_VERSION_MINOR >= 16
+    tud_vendor_write_flush();
+#endif
+}
+
+void bulk_receive(uint8_t *to) {
+    dest = to;
+    received = 0;
+    state = to ? STATE_LOAD : STATE_DISCARD;
+    last_ms = to_ms_since_boot(get_absolute_time());
+}
+
+// read the next header, anything that isn't one is dropped and refused
+static int read_header(bulk_load_t *load) {
+    have += tud_vendor_read(header + have, sizeof(header) - have);
+    if (have < sizeof(header)) return BULK_IDLE;
+    have = 0;
+    op = header[2];
+    length = get32(&header[4]);
+    received = 0;
+    last_ms = to_ms_since_boot(get_absolute_time());
+    if (header[0] != 'P' || header[1] != 'B') {
+        uint8_t drop[64];
+        while (tud_vendor_available()) tud_vendor_read(drop, sizeof(drop));
+        bulk_reply(BULK_STATUS_INVALID, 0);
+        return BULK_IDLE;
+    }
+    if (op == BULK_OP_LOOPBACK) {
+        if (length == 0) bulk_reply(BULK_STATUS_OK, 0);
+        else state = STATE_LOOPBACK;
+        return BULK_IDLE;
+    }
+    if (op != BULK_OP_LOAD || length == 0 || length > ROM_SIZE) {
+        state = STATE_DISCARD;
+        return BULK_IDLE;
+    }
+    load->bank = header[3];
+    load->length = length;
+    load->crc = get32(&header[8]);
+    load->status = BULK_STATUS_OK;
+    state = STATE_WAIT;
+    return BULK_START;
+}
+
+// Run the interface, called while core 0 waits for the latch
+int bulk_poll(bulk_load_t *load) {
+    uint8_t buf[64];
+    uint32_t n;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    if (state == STATE_WAIT) return BULK_IDLE;
+    if (state == STATE_HEADER) {
+        return tud_vendor_available() ? read_header(load) : BULK_IDLE;
+    }
+    if (!tud_vendor_available()) {
+        if (now - last_ms < BULK_TIMEOUT_MS) return BULK_IDLE;
+        int loading = state == STATE_LOAD;
+        state = STATE_HEADER;
+        if (loading) {
+            load->status = BULK_STATUS_TIMEOUT;
+            return BULK_DONE;
+        }
+        bulk_reply(BULK_STATUS_TIMEOUT, 0);
+        return BULK_IDLE;
+    }
+    last_ms = now;
+    switch (state) {
+        case STATE_LOAD:
+            received += tud_vendor_read(dest + received, length - received);
+            break;
+        case STATE_DISCARD:
+            received += tud_vendor_read(buf, MIN(sizeof(buf), length - received));
+            break;
+        case STATE_LOOPBACK:
+            n = MIN(MIN(sizeof(buf), length - received), tud_vendor_write_available());
+            n = tud_vendor_read(buf, n);
+            tud_vendor_write(buf, n);
+#if TUSB_VERSION_MAJOR > 0 || TUSB_VERSION_MINOR >= 16
+            tud_vendor_write_flush();
+#endif
+            received += n;
+            break;
+    }
+    if (received < length) return BULK_IDLE;
+    if (state == STATE_LOAD) {
+        state = STATE_HEADER;
+        return BULK_DONE;
+    }
+    bulk_reply(state == STATE_DISCARD ? BULK_STATUS_INVALID : BULK_STATUS_OK, 0);
+    state = STATE_HEADER;
+    return BULK_IDLE;
+}
@@ -0,0 +1,38 @@
+#ifndef _BULK_H_
+#define _BULK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BULK_HEADER_SIZE    12
+#define BULK_REPLY_SIZE     8
+#define BULK_TIMEOUT_MS     1000    // gap allowed in the data of a transfer, and to send a reply
+
+// ops
+#define BULK_OP_LOAD        1   // ROM image for a bank, 0xff is the lower ROM
+#define BULK_OP_LOOPBACK    2   // the data is sent back, for throughput tests
+
+// reply status
+#define BULK_STATUS_OK      0
+#define BULK_STATUS_INVALID 1   // bad header, op, bank or length
+#define BULK_STATUS_CRC     2   // the data doesn't match the CRC32 in the header
+#define BULK_STATUS_TIMEOUT 3
+#define BULK_STATUS_BUSY    4   // the bank used as the shadow was loaded during the transfer
+
+// bulk_poll results
+#define BULK_IDLE           0
+#define BULK_START          1   // a load header has arrived, say where the data goes with bulk_receive
+#define BULK_DONE           2   // the load data is in, or status says why not. Answer with bulk_reply
+
+typedef struct {
+    uint8_t bank;
+    uint8_t status;
+    uint32_t length;
+    uint32_t crc;       // CRC32 of the data from the header
+} bulk_load_t;
+
+int bulk_poll(bulk_load_t *load);
+// length bytes of data go to dest, or are discarded and answered with BULK_STATUS_INVALID if NULL
+void bulk_receive(uint8_t *dest);
+void bulk_reply(uint8_t status, uint32_t crc);
+#endif
@@ -0,0 +1,142 @@
+// Directory listing cache
+// Each directory is read with f_readdir once, then listed, sorted and paged from RAM.
+// Entries and names for all cached directories share one pool; when it fills up
+// the whole cache is dropped and refilled with the directory being listed.
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ff.h>
+#include "picorom.h"
+#include "dircache.h"
+
+typedef struct {
+    uint16_t path;      // offset of the directory path in the pool
+    uint16_t first;     // first entry
+    uint16_t count;
+    uint8_t sort;       // current order of the entries
+} dircache_dir_t;
+
+static dircache_entry_t entries[DIRCACHE_MAX_ENTRIES];
+static char pool[DIRCACHE_POOL_SIZE];
+static dircache_dir_t dirs[DIRCACHE_MAX_DIRS];
+static int num_dirs;
+static int num_entries;
+static int pool_used;
+
+// current listing
+static int list_pos;
+static int list_end;
+
+void dircache_invalidate(void) {
+    num_dirs = 0;
+    num_entries = 0;
+    pool_used = 0;
+    list_pos = list_end = 0;
+}
+
+static int add_string(const char *s) {
+    int l = strlen(s) + 1;
+    if (pool_used + l > DIRCACHE_POOL_SIZE) return -1;
+    memcpy(&pool[pool_used], s, l);
+    pool_used += l;
+    return pool_used - l;
+}
+
+// directories first, then by name or size
+static int compare_name(const void *a, const void *b) {
+    const dircache_entry_t *ea = a, *eb = b;
+    if (ea->is_dir != eb->is_dir) return eb->is_dir - ea->is_dir;
+    return strcasecmp(&pool[ea->name], &pool[eb->name]);
+}
+
+static int compare_size(const void *a, const void *b) {
+    const dircache_entry_t *ea = a, *eb = b;
+    if (ea->is_dir != eb->is_dir) return eb->is_dir - ea->is_dir;
+    if (ea->size != eb->size) return ea->size < eb->size ? -1 : 1;
+    return strcasecmp(&pool[ea->name], &pool[eb->name]);
+}
+
+// read a directory into the cache. Returns NULL if it can't be opened.
+// A directory too big for the cache is truncated.
+static dircache_dir_t *load_dir(const char *path) {
+    static FILINFO fno;
+    DIR dir;
+    dircache_dir_t *d;
+    int p;
+
+    if (f_opendir(&dir, *path ? path : "/") != FR_OK) return NULL;
+    if (num_dirs == DIRCACHE_MAX_DIRS || (p = add_string(path)) < 0) {
+        dircache_invalidate();
+        p = add_string(path);
+    }
+    d = &dirs[num_dirs++];
+    d->path = p;
+    d->first = num_entries;
+    d->count = 0;
+    d->sort = DIRCACHE_SORT_NAME;
+    while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+        if (fno.fattrib & (AM_HID|AM_SYS)) continue;
+        int n = -1;
+        if (num_entries < DIRCACHE_MAX_ENTRIES) n = add_string(fno.fname);
+        if (n < 0) {
+            if (num_dirs == 1) {
+                fdebug("dircache: %s truncated at %d entries", path, d->count);
+                break;
+            }
+            // out of room - drop everything else and start again with just this directory
+            f_closedir(&dir);
+            dircache_invalidate();
+            return load_dir(path);
+        }
+        entries[num_entries].name = n;
+        entries[num_entries].size = fno.fsize;
+        entries[num_entries].is_dir = (fno.fattrib & AM_DIR) != 0;
+        num_entries++;
+        d->count++;
+    }
+    f_closedir(&dir);
+    qsort(&entries[d->first], d->count, sizeof(dircache_entry_t), compare_name);
+    return d;
+}
+
+static dircache_dir_t *find_dir(const char *path) {
+    for (int i=0;i<num_dirs;i++) {
+        if (strcasecmp(&pool[dirs[i].path], path) == 0) return &dirs[i];
+    }
+    return load_dir(path);
+}
+
+// Start listing a directory. page is DIRCACHE_ALL_PAGES or a page of DIRCACHE_PAGE_SIZE entries
+bool dircache_first(const char *path, int sort, int page, const char **name, const dircache_entry_t **entry) {
+    char clean[256];
+    dircache_dir_t *d;
+
+    // no leading or trailing /
+    while (*path == '/') path++;
+    strncpy(clean, path, sizeof(clean) - 1);
+    clean[sizeof(clean) - 1] = 0;
+    for (int l = strlen(clean); l > 0 && clean[l-1] == '/'; l--) clean[l-1] = 0;
+
+    list_pos = list_end = 0;
+    if ((d = find_dir(clean)) == NULL) return false;
+    if (d->sort != sort) {
+        qsort(&entries[d->first], d->count, sizeof(dircache_entry_t),
+            sort == DIRCACHE_SORT_SIZE ? compare_size : compare_name);
+        d->sort = sort;
+    }
+    list_pos = d->first;
+    list_end = d->first + d->count;
+    if (page != DIRCACHE_ALL_PAGES) {
+        list_pos += page * DIRCACHE_PAGE_SIZE;
+        if (list_pos > list_end) list_pos = list_end;
+        if (list_end > list_pos + DIRCACHE_PAGE_SIZE) list_end = list_pos + DIRCACHE_PAGE_SIZE;
+    }
+    return dircache_next(name, entry);
+}
+
+bool dircache_next(const char **name, const dircache_entry_t **entry) {
+    if (list_pos >= list_end) return false;
+    *entry = &entries[list_pos++];
+    *name = &pool[(*entry)->name];
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef _DIRCACHE_H_
+#define _DIRCACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// In-RAM cache of directory listings, filled on first visit and dropped when the drive changes
+#ifndef DIRCACHE_MAX_ENTRIES
+#define DIRCACHE_MAX_ENTRIES    512
+#endif
+#ifndef DIRCACHE_POOL_SIZE
+#define DIRCACHE_POOL_SIZE      8192    // names and paths
+#endif
+#define DIRCACHE_MAX_DIRS       8
+#define DIRCACHE_PAGE_SIZE      20
+#define DIRCACHE_ALL_PAGES      0xff
+
+#define DIRCACHE_SORT_NAME      0
+#define DIRCACHE_SORT_SIZE      1
+
+typedef struct {
+    uint32_t size;
+    uint16_t name;      // offset of the name in the string pool
+    uint8_t is_dir;
+} dircache_entry_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void dircache_invalidate(void);
+bool dircache_first(const char *path, int sort, int page, const char **name, const dircache_entry_t **entry);
+bool dircache_next(const char **name, const dircache_entry_t **entry);
+#ifdef __cplusplus
+}
+#endif
+#endif
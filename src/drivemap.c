@@ -0,0 +1,130 @@
+// Flash drive placement
+// The drive takes everything from the end of the firmware, plus DRIVEMAP_SPARE for later
+// firmware to grow into, up to the end of the flash chip (as reported by its JEDEC ID, and no
+// further than PICO_FLASH_SIZE_BYTES, as the FTL map in RAM grows with the drive). The erase
+// block in front of the drive holds a header with the start and length the FTL was formatted
+// with, and that layout is kept until the next format, even when a new firmware or a bigger
+// chip would allow more. A format moves the drive to the current layout, so that is the
+// migration path: copy the files off, format, copy them back.
+//
+// Boards formatted by older firmware have no header and their drive at the fixed 1.5MB
+// location. That drive is kept and given a header, unless the area is blank.
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "drivemap.h"
+
+#ifdef USE_XIP_CACHE_AS_RAM
+// the XIP cache SRAM holds the lower ROM: read the flash through the alias that never
+// allocates, and turn the cache back off after the boot ROM flash functions turn it on
+#define FLASH_READ(a)   ((a) - XIP_BASE + XIP_NOCACHE_NOALLOC_BASE)
+#define CACHE_OFF()     hw_clear_bits(&xip_ctrl_hw->ctrl, XIP_CTRL_EN_BITS)
+#else
+#define FLASH_READ(a)   (a)
+#define CACHE_OFF()
+#endif
+
+extern char __flash_binary_end[];
+
+static drivemap_t map;
+
+static uint32_t firmware_end(void) {
+    return ((uint32_t)__flash_binary_end + DRIVEMAP_BLOCK - 1) & ~(DRIVEMAP_BLOCK - 1);
+}
+
+uint32_t drivemap_flash_size(void) {
+    static uint32_t size;
+    if (!size) {
+        uint8_t tx[4] = {0x9f};     // JEDEC ID: manufacturer, type, log2(capacity)
+        uint8_t rx[4];
+        uint32_t ints = save_and_disable_interrupts();
+        flash_do_cmd(tx, rx, sizeof(tx));
+        CACHE_OFF();
+        restore_interrupts(ints);
+        size = rx[3] >= 20 && rx[3] <= 24 ? 1u << rx[3] : PICO_FLASH_SIZE_BYTES;
+    }
+    return size;
+}
+
+static uint32_t flash_end(void) {
+    return XIP_BASE + drivemap_flash_size();
+}
+
+// a drive made by a firmware built for a bigger chip is still used, but not made
+static uint32_t layout_end(void) {
+    return XIP_BASE + MIN(drivemap_flash_size(), PICO_FLASH_SIZE_BYTES);
+}
+
+static bool valid(const drivemap_t *m, uint32_t header) {
+    return m->magic == DRIVEMAP_MAGIC && m->version == DRIVEMAP_VERSION && m->check == drivemap_check(m) &&
+        m->start == header + DRIVEMAP_BLOCK && m->length && m->length % DRIVEMAP_BLOCK == 0 &&
+        m->start + m->length <= flash_end();
+}
+
+static void write_header(const drivemap_t *m) {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xff, sizeof(page));
+    memcpy(page, m, sizeof(*m));
+    uint32_t offset = m->start - DRIVEMAP_BLOCK - XIP_BASE;
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(offset, DRIVEMAP_BLOCK);
+    flash_range_program(offset, page, sizeof(page));
+    CACHE_OFF();
+    restore_interrupts(ints);
+}
+
+static void erase_header(const drivemap_t *m) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(m->start - DRIVEMAP_BLOCK - XIP_BASE, DRIVEMAP_BLOCK);
+    CACHE_OFF();
+    restore_interrupts(ints);
+}
+
+// a drive from older firmware is there if any of its erase blocks has been written
+static bool legacy_drive(void) {
+    if (firmware_end() > DRIVEMAP_LEGACY_START - DRIVEMAP_BLOCK ||
+        DRIVEMAP_LEGACY_START + DRIVEMAP_LEGACY_LEN > flash_end()) return false;
+    for (uint32_t a = DRIVEMAP_LEGACY_START; a < DRIVEMAP_LEGACY_START + DRIVEMAP_LEGACY_LEN; a += DRIVEMAP_BLOCK) {
+        if (*(const uint32_t *)FLASH_READ(a) != 0xffffffff) return true;
+    }
+    return false;
+}
+
+const drivemap_t *drivemap_init(void) {
+    // the first header after the firmware, there can be two if a format was interrupted
+    for (uint32_t a = firmware_end(); a < flash_end(); a += DRIVEMAP_BLOCK) {
+        if (valid((const drivemap_t *)FLASH_READ(a), a)) {
+            memcpy(&map, (const void *)FLASH_READ(a), sizeof(map));
+            return &map;
+        }
+    }
+    if (legacy_drive()) {
+        map.magic = DRIVEMAP_MAGIC;
+        map.version = DRIVEMAP_VERSION;
+        map.start = DRIVEMAP_LEGACY_START;
+        map.length = DRIVEMAP_LEGACY_LEN;
+        map.check = drivemap_check(&map);
+    } else {
+        drivemap_layout(&map, firmware_end(), layout_end());
+    }
+    write_header(&map);
+    return &map;
+}
+
+bool drivemap_reset(void) {
+    drivemap_t old = map;
+    drivemap_layout(&map, firmware_end(), layout_end());
+    if (map.start == old.start && map.length == old.length) return false;
+    // new header first, so an interrupted move still finds one of them
+    write_header(&map);
+    if (old.start != map.start) erase_header(&old);
+    return true;
+}
+
+uint32_t drivemap_available(void) {
+    drivemap_t m;
+    drivemap_layout(&m, firmware_end(), layout_end());
+    return m.length;
+}
@@ -0,0 +1,53 @@
+#ifndef _DRIVEMAP_H_
+#define _DRIVEMAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Where the flash drive lives, see drivemap.c. The drive follows the firmware and runs to the
+// end of the flash, and a header in the erase block before it records the layout the FTL was
+// formatted with, so a firmware or chip change can't move a drive under its files.
+#define DRIVEMAP_MAGIC          0x50414d44  // "DMAP"
+#define DRIVEMAP_VERSION        1
+#define DRIVEMAP_BLOCK          4096        // flash erase block
+#define DRIVEMAP_SPARE          (64 * 1024) // firmware growth allowed before a drive has to move
+// the fixed layout of older firmware, 1.5MB at the end of a 2MB flash, used without a header
+#define DRIVEMAP_LEGACY_START   0x10080000
+#define DRIVEMAP_LEGACY_LEN     (1536 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t start;     // XIP address of the first erase block of the drive
+    uint32_t length;
+    uint32_t check;
+} drivemap_t;
+
+static inline uint32_t drivemap_check(const drivemap_t *map) {
+    return ~(map->magic ^ map->version ^ map->start ^ map->length);
+}
+
+// the layout a format uses for a firmware image ending at firmware_end
+static inline void drivemap_layout(drivemap_t *map, uint32_t firmware_end, uint32_t flash_end) {
+    uint32_t header = (firmware_end + DRIVEMAP_SPARE + DRIVEMAP_BLOCK - 1) & ~(DRIVEMAP_BLOCK - 1);
+    map->magic = DRIVEMAP_MAGIC;
+    map->version = DRIVEMAP_VERSION;
+    map->start = header + DRIVEMAP_BLOCK;
+    map->length = flash_end > map->start ? (flash_end - map->start) & ~(DRIVEMAP_BLOCK - 1) : 0;
+    map->check = drivemap_check(map);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// find the drive, writing a header for a drive left by older firmware
+const drivemap_t *drivemap_init(void);
+// move to the layout for this firmware and flash before a format, true if it changed
+bool drivemap_reset(void);
+// flash size from the JEDEC ID, and the drive length a format would give
+uint32_t drivemap_flash_size(void);
+uint32_t drivemap_available(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,7 +1,10 @@
 #include "ff.h"
 #include "diskio.h"
 #include "flash.h"
+#include "picorom.h"
 
+uint32_t disk_meta_reads;
+uint32_t disk_data_start;
 
 DSTATUS disk_status(BYTE drv) {
     return RES_OK;
@@ -13,23 +16,20 @@ DSTATUS disk_initialize(BYTE drv) {
 }
 
 DRESULT disk_read(BYTE drv, BYTE *buff, LBA_t sector, UINT count) {
-    if (sector > get_lba_count()) {
+    if (sector + count > get_lba_count()) {
         return RES_ERROR;
     }
-    for (unsigned int i = 0; i < count; i++) {
-        flash_read(sector + i, buff + i * get_lba_size());
+    if (sector < disk_data_start) {
+        disk_meta_reads += MIN(count, disk_data_start - sector);
     }
-    return RES_OK;
+    return flash_read_blocks(sector, buff, count) ? RES_OK : RES_ERROR;
 }
 
 DRESULT disk_write(BYTE drv, const BYTE *buff, LBA_t sector, UINT count) {
-    if (sector > get_lba_count()) {
+    if (sector + count > get_lba_count()) {
         return RES_ERROR;
     }
-    for (unsigned int i = 0; i < count; i++) {
-        flash_write(sector + i, buff + i * get_lba_size());
-    }
-    return RES_OK;
+    return flash_write_blocks(sector, buff, count) ? RES_OK : RES_ERROR;
 }
 
 DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff) {
@@ -38,7 +38,8 @@ DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff) {
         return RES_OK;
     }
     if (ctrl == GET_BLOCK_SIZE) {
-        *(DWORD *)buff = get_lba_size();
+        // erase block in sectors, f_mkfs aligns the data area to it
+        *(DWORD *)buff = DRIVE_ERASE_BLOCK / get_lba_size();
         return RES_OK;
     } 
     if (ctrl == CTRL_SYNC) {
@@ -1,9 +1,60 @@
 #include "flash.h"
+#include <new>
+#include <malloc.h>
+#include <unistd.h>
 #include <FlashInterfaceRP2040_SDK.h>
 #include <SPIFTL.h>
+#include "stats.h"
+#include "sectorcache.h"
+#include "picorom.h"
+#include "drivemap.h"
+#include "boottime.h"
 
-FlashInterfaceRP2040_SDK fi( (uint8_t *)__DRIVE_START,  (uint8_t *)__DRIVE_END);
-SPIFTL ftl(&fi);
+// placed by drivemap_init(), and the FTL built over it once the region is known
+FlashInterfaceRP2040_SDK fi(NULL, NULL);
+alignas(SPIFTL) static uint8_t ftl_storage[sizeof(SPIFTL)];
+static SPIFTL *ftl;
+static const drivemap_t *drive;
+
+// FTL sectors in each drive sector
+#define FTL_PER_SECTOR (DRIVE_SECTOR_SIZE / ftl->lbaBytes)
+
+// sectors the host or FatFs asked for, against what reached the flash in fi
+static uint32_t sector_reads;
+static uint32_t sector_writes;
+static uint32_t sector_trims;
+static uint32_t read_runs;      // FatFs calls, each a run of sectors
+static uint32_t write_runs;
+static uint32_t bytes_written;
+static uint32_t persists;
+// heap the FTL took for its map when it started, and what is left, to size NUM_ROM_BANKS by
+static uint32_t ftl_heap;
+
+extern char __StackLimit[];
+
+static uint32_t heap_free(void) {
+    struct mallinfo m = mallinfo();
+    return (uint32_t)(__StackLimit - (char *)sbrk(0)) + m.fordblks;
+}
+
+static int ftl_text(char *buf, int size) {
+    uint32_t amplification = bytes_written ? (uint32_t)(fi.programBytes * 100ull / bytes_written) : 0;
+    return snprintf(buf, size, "%-20s %u.%02u\r\n%-20s %u x %u\r\n%-20s 0x%08x\r\n%-20s %u\r\n%-20s %u\r\n%-20s %u\r\n%-20s %u\r\n%-20s %u\r\n",
+        "write_amplification", amplification / 100, amplification % 100,
+        "sectors", get_lba_count(), get_lba_size(),
+        "drive_start", drive->start,
+        "drive_length", drive->length,
+        "drive_after_format", drivemap_available(),
+        "flash_size", drivemap_flash_size(),
+        "ftl_heap", ftl_heap,
+        "heap_free", heap_free());
+}
+
+static void ftl_create(void) {
+    if (ftl) ftl->~SPIFTL();
+    fi.setRegion((const uint8_t *)drive->start, (const uint8_t *)(drive->start + drive->length));
+    ftl = new (ftl_storage) SPIFTL(&fi);
+}
 
 
 // e.g. https://github.com/earlephilhower/SPIFTL
@@ -12,7 +63,10 @@ bool flash_format() {
     #if FLASH_DEBUG
     printf("flash_format()\n");
     #endif
-    return ftl.format();
+    sectorcache_clear();
+    // the one point where the drive can move, see drivemap.c
+    if (drivemap_reset()) ftl_create();
+    return ftl->format();
 }
 
 bool flash_init() {
@@ -23,41 +77,118 @@ bool flash_init() {
     if (init_done) {
         return init_done;
     }
-    init_done = ftl.start();
+    stats_counter(STATS_FILE_FTL, "sector_reads", &sector_reads);
+    stats_counter(STATS_FILE_FTL, "sector_writes", &sector_writes);
+    stats_counter(STATS_FILE_FTL, "sector_trims", &sector_trims);
+    stats_counter(STATS_FILE_FTL, "read_runs", &read_runs);
+    stats_counter(STATS_FILE_FTL, "write_runs", &write_runs);
+    stats_counter(STATS_FILE_FTL, "meta_reads", &disk_meta_reads);
+    stats_counter(STATS_FILE_FTL, "bytes_written", &bytes_written);
+    stats_counter(STATS_FILE_FTL, "persists", &persists);
+    stats_counter(STATS_FILE_FTL, "cache_hits", &sectorcache_hits);
+    stats_counter(STATS_FILE_FTL, "cache_misses", &sectorcache_misses);
+    stats_counter(STATS_FILE_FTL, "erases", &fi.erases);
+    stats_counter(STATS_FILE_FTL, "program_bytes", &fi.programBytes);
+    stats_text(STATS_FILE_FTL, ftl_text);
+    drive = drivemap_init();
+    uint32_t heap_used = mallinfo().uordblks;
+    ftl_create();
+    init_done = ftl->start();
+    ftl_heap = mallinfo().uordblks - heap_used;
+    boot_mark("FTL start", NULL);
     return init_done;
 }
 bool flash_read(int block, uint8_t *buffer) {
     #if FLASH_DEBUG
     printf("flash_read(%d, buffer)\n", block);
     #endif
-    return ftl.read(block, buffer);
+    sector_reads++;
+    if (sectorcache_read(block, buffer)) return true;
+    for (int i = 0; i < FTL_PER_SECTOR; i++) {
+        if (!ftl->read(block * FTL_PER_SECTOR + i, buffer + i * ftl->lbaBytes)) return false;
+    }
+    sectorcache_fill(block, buffer);
+    return true;
 }
 
 bool flash_write(int block, const uint8_t *buffer) {
     #if FLASH_DEBUG
     printf("flash_write(%d, buffer)\n", block);
     #endif
-    return ftl.write(block, buffer);
+    sector_writes++;
+    bytes_written += DRIVE_SECTOR_SIZE;
+    // the FTL takes one of its 512 byte sectors per write, so a 4K drive sector is 8 writes.
+    // Whether they share an erase block is up to SPIFTL, see program_bytes and erases in FTL.TXT
+    for (int i = 0; i < FTL_PER_SECTOR; i++) {
+        if (!ftl->write(block * FTL_PER_SECTOR + i, buffer + i * ftl->lbaBytes)) {
+            sectorcache_trim(block);
+            return false;
+        }
+    }
+    sectorcache_fill(block, buffer);
+    return true;
+}
+
+bool flash_read_blocks(int block, uint8_t *buffer, int count) {
+    read_runs++;
+    for (int i = 0; i < count; i++) {
+        if (!flash_read(block + i, buffer + i * DRIVE_SECTOR_SIZE)) return false;
+    }
+    return true;
+}
+
+bool flash_write_blocks(int block, const uint8_t *buffer, int count) {
+    write_runs++;
+    for (int i = 0; i < count; i++) {
+        if (!flash_write(block + i, buffer + i * DRIVE_SECTOR_SIZE)) return false;
+    }
+    return true;
+}
+
+bool flash_read_part(int block, uint32_t offset, uint8_t *buffer, uint32_t len) {
+    if (offset == 0 && len == DRIVE_SECTOR_SIZE) return flash_read(block, buffer);
+    sector_reads++;
+    for (uint32_t i = 0; i < len / ftl->lbaBytes; i++) {
+        if (!ftl->read(block * FTL_PER_SECTOR + offset / ftl->lbaBytes + i, buffer + i * ftl->lbaBytes)) return false;
+    }
+    return true;
+}
+
+bool flash_write_part(int block, uint32_t offset, const uint8_t *buffer, uint32_t len) {
+    if (offset == 0 && len == DRIVE_SECTOR_SIZE) return flash_write(block, buffer);
+    sector_writes++;
+    bytes_written += len;
+    // the cached copy would need the rest of the sector
+    sectorcache_trim(block);
+    for (uint32_t i = 0; i < len / ftl->lbaBytes; i++) {
+        if (!ftl->write(block * FTL_PER_SECTOR + offset / ftl->lbaBytes + i, buffer + i * ftl->lbaBytes)) return false;
+    }
+    return true;
 }
 
 void flash_persist() {
     #if FLASH_DEBUG
     printf("flash_persist()\n");
     #endif
-    ftl.persist();
+    persists++;
+    ftl->persist();
 }
 
 void flash_trim(int lba) {
     #if FLASH_DEBUG
     printf("flash_trim(%d)\n", lba);
     #endif
-    ftl.trim(lba);
+    sector_trims++;
+    sectorcache_trim(lba);
+    for (int i = 0; i < FTL_PER_SECTOR; i++) {
+        ftl->trim(lba * FTL_PER_SECTOR + i);
+    }
 }
 
 uint16_t get_lba_count() { 
-    return ftl.lbaCount();
+    return ftl->lbaCount() / FTL_PER_SECTOR;
 }
 
 uint16_t get_lba_size() { 
-    return ftl.lbaBytes;
+    return DRIVE_SECTOR_SIZE;
 }
\ No newline at end of file
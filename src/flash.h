@@ -13,10 +13,6 @@
 #define FLASH_DEBUG 0
 #endif
 
-extern uint32_t __DRIVE_START[];
-extern uint32_t __DRIVE_LEN[];
-extern uint32_t __DRIVE_END[];
-
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,10 +20,20 @@ bool flash_format();
 bool flash_init();
 bool flash_read(int block, uint8_t *buffer);
 bool flash_write(int block, const uint8_t *buffer);
+// a run of count sectors, as FatFs passes them
+bool flash_read_blocks(int block, uint8_t *buffer, int count);
+bool flash_write_blocks(int block, const uint8_t *buffer, int count);
+// part of a sector, in whole FTL sectors, for USB transfers smaller than a 4K sector
+bool flash_read_part(int block, uint32_t offset, uint8_t *buffer, uint32_t len);
+bool flash_write_part(int block, uint32_t offset, const uint8_t *buffer, uint32_t len);
 uint16_t get_lba_count(); 
 uint16_t get_lba_size(); 
 void flash_persist();
 void flash_trim(int);
+// FatFs reads of sectors before disk_data_start (boot sector, FATs and root directory), see
+// fatfs_driver.c. main.c sets disk_data_start once the volume is mounted
+extern uint32_t disk_meta_reads;
+extern uint32_t disk_data_start;
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,644 @@
+// hostsim - run picorom.rom against the firmware's command code on the PC
+// A Z80 (z80.c) runs the RSXs of picorom.rom with the upper ROM window at &C000 and the latch at
+// &DFxx. Its ROM reads and latch writes drive main.c's own bus loop and handle_latch()/dispatch()
+// through the SDK model in sdk.cpp, on a RAM drive formatted and mounted by the firmware's
+// code. Each RSX is reported with its T-states, latch bytes, commands and round trips.
+//
+// With -c the RSXs are run once for each bus loop shape and the printed text compared, and every
+// address of every bank is read through each shape and checked against the RAM copies.
+//
+// What this can't tell: how long the firmware takes. Core 0 runs in no CPC time, and the bus
+// loop is one pass per CPC access. ARM cycles and ROMEN to data latency are measured on the
+// board with the latency build, see the readme.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+#include "pico_host.h"
+#define main firmware_main
+#include "../main.c"
+#undef main
+#include "z80.h"
+
+#define DISK_BYTES      (1536 * 1024)   // the legacy drive size, see drivemap.h
+#define RAM_TOP         0xbff0          // stack for the RSX call
+#define RETURN_ADDRESS  0xbe00          // the RSX returns here
+#define PARAM_BLOCK     0xa000          // BASIC's parameter block, IX points here
+#define PARAM_STRINGS   0xa100          // string descriptors, then the text
+#define PSAVE_DATA      0x4000          // a pattern for |PSAVE to send
+#define TSTATE_LIMIT    50000000ULL     // 12.5s of CPC time
+
+// Firmware modules the harness leaves out: the FTL is a RAM drive, the DMA CRC is done in
+// software, and nothing is plugged into USB
+
+static uint8_t disk[DISK_BYTES];
+
+bool flash_format() {
+    memset(disk, 0xff, sizeof(disk));
+    return true;
+}
+bool flash_init() { return true; }
+bool flash_read(int block, uint8_t *buffer) { return flash_read_blocks(block, buffer, 1); }
+bool flash_write(int block, const uint8_t *buffer) { return flash_write_blocks(block, buffer, 1); }
+bool flash_read_blocks(int block, uint8_t *buffer, int count) {
+    memcpy(buffer, &disk[block * DRIVE_SECTOR_SIZE], count * DRIVE_SECTOR_SIZE);
+    return true;
+}
+bool flash_write_blocks(int block, const uint8_t *buffer, int count) {
+    memcpy(&disk[block * DRIVE_SECTOR_SIZE], buffer, count * DRIVE_SECTOR_SIZE);
+    return true;
+}
+bool flash_read_part(int block, uint32_t offset, uint8_t *buffer, uint32_t len) {
+    memcpy(buffer, &disk[block * DRIVE_SECTOR_SIZE + offset], len);
+    return true;
+}
+bool flash_write_part(int block, uint32_t offset, const uint8_t *buffer, uint32_t len) {
+    memcpy(&disk[block * DRIVE_SECTOR_SIZE + offset], buffer, len);
+    return true;
+}
+uint16_t get_lba_count() { return DISK_BYTES / DRIVE_SECTOR_SIZE; }
+uint16_t get_lba_size() { return DRIVE_SECTOR_SIZE; }
+void flash_persist() {}
+void flash_trim(int block) { (void)block; }
+
+static bool crc_pending;
+static uint32_t crc_result;
+
+void romcrc_init(void) {}
+uint32_t romcrc_compute(const uint8_t *data, uint32_t len, uint32_t split, uint32_t *first) {
+    if (split > len) split = len;
+    *first = crc32_update(0, data, split);
+    return crc32_update(*first, data + split, len - split);
+}
+void romcrc_start(const uint8_t *data, uint32_t len) {
+    crc_result = crc32_update(0, data, len);
+    crc_pending = true;
+}
+bool romcrc_busy(void) { return crc_pending; }
+bool romcrc_done(uint32_t *crc) {
+    if (!crc_pending) return false;
+    crc_pending = false;
+    *crc = crc_result;
+    return true;
+}
+void romcrc_abort(void) { crc_pending = false; }
+
+void live_init(uint8_t *lower, uint8_t *upper, int banks, void (*hold)(void)) { (void)lower; (void)upper; (void)banks; (void)hold; }
+bool live_pending(void) { return false; }
+uint32_t live_take(uint32_t quiet_ms) { (void)quiet_ms; return 0; }
+int32_t live_length(int file) { (void)file; return LIVE_LENGTH_UNKNOWN; }
+void msc_set_live(bool on) { (void)on; }
+
+int bulk_poll(bulk_load_t *load) { (void)load; return BULK_IDLE; }
+void bulk_receive(uint8_t *dest) { (void)dest; }
+void bulk_reply(uint8_t status, uint32_t crc) { (void)status; (void)crc; }
+
+bool usbcmd_ready(void) { return false; }
+uint32_t usbcmd_get(void) { return 0; }
+bool usbcmd_aborted(void) { return false; }
+void usbcmd_respond(const uint8_t *resp) { (void)resp; }
+
+uint32_t drivemap_flash_size(void) { return PICO_FLASH_SIZE_BYTES; }
+
+// the CPC side
+
+typedef struct {
+    uint64_t tstates;
+    uint32_t latch_bytes;
+    uint32_t lost;          // latch writes dropped with the FIFO full
+    uint32_t commands;
+    uint32_t round_trips;   // responses the Z80 waited for
+    uint32_t polls;         // Z80 reads of the response sequence number
+    uint64_t rom_reads;
+    uint32_t keys;
+    bool reset;             // the firmware reset the CPC
+    bool timeout;
+} rsx_result_t;
+
+static z80_t cpu;
+static uint8_t ram[0x10000];
+static rsx_result_t *counts;
+static std::string screen;
+static int control_bank = 1;
+static uint8_t last_seq;
+static int verbose;
+
+// One access with ROMEN low, then ROMEN high until the next, as the bus loop sees the CPC
+static uint8_t rom_read(uint16_t addr) {
+    uint32_t pins = (addr & ADDRESS_BUS_MASK) | ((addr & 0x8000) ? A15_MASK : 0);
+    uint8_t data = 0xff;    // nothing drives the bus
+    if (counts) {
+        counts->rom_reads++;
+        if (addr == 0xc000 + RESP_BUF + RESP_SEQ) counts->polls++;
+    }
+    hostsim_bus_pass(pins);
+    if ((hostsim_pins_dir() & DATA_BUS_MASK) == DATA_BUS_MASK) {
+        data = (hostsim_pins_out() & DATA_BUS_MASK) >> 14;
+    }
+    hostsim_bus_pass(ROMEN_MASK);
+    return data;
+}
+
+static void latch_write(uint8_t value) {
+    if (counts) counts->latch_bytes++;
+    if (!hostsim_latch_write(value) && counts) counts->lost++;
+    hostsim_bus_pass(ROMEN_MASK);
+}
+
+// RAM, with the upper ROM enabled over &C000 and the lower ROM disabled, as for an RSX
+static uint8_t cpc_read(void *ctx, uint16_t addr) {
+    (void)ctx;
+    return addr >= 0xc000 ? rom_read(addr) : ram[addr];
+}
+static void cpc_write(void *ctx, uint16_t addr, uint8_t value) {
+    (void)ctx;
+    ram[addr] = value;
+}
+static uint8_t cpc_in(void *ctx, uint16_t port) {
+    (void)ctx; (void)port;
+    return 0xff;
+}
+static void cpc_out(void *ctx, uint16_t port, uint8_t value) {
+    (void)ctx;
+    if ((port >> 8) == 0xdf) latch_write(value);
+}
+
+static void push(uint16_t value) {
+    ram[--cpu.sp] = value >> 8;
+    ram[--cpu.sp] = value & 0xff;
+}
+
+static uint16_t pop(void) {
+    uint16_t value = ram[cpu.sp] | ram[(uint16_t)(cpu.sp + 1)] << 8;
+    cpu.sp += 2;
+    return value;
+}
+
+// Jump block entry of an RSX in the control ROM, 0 if it has no such name
+static uint16_t rsx_entry(const char *name) {
+    const uint8_t *rom = UPPER_ROMS[control_bank];
+    uint16_t p = (rom[4] | rom[5] << 8) - 0xc000;
+    for (int i = 0; p < ROM_SIZE && rom[p]; i++) {
+        char buf[32];
+        int n = 0;
+        while (p < ROM_SIZE) {
+            uint8_t c = rom[p++];
+            if (n < 31) buf[n++] = c & 0x7f;
+            if (c & 0x80) break;
+        }
+        buf[n] = 0;
+        if (strcasecmp(buf, name) == 0) return 0xc006 + 3 * i;
+    }
+    return 0;
+}
+
+// Parameters as BASIC passes them: A is the count and IX points to the last, each a word.
+// Numbers are decimal or &hex, strings are "quoted" and passed as descriptors
+static bool rsx_params(const std::vector<std::string> &args) {
+    uint16_t text = PARAM_STRINGS + 3 * args.size();
+    uint16_t desc = PARAM_STRINGS;
+    int n = args.size();
+    for (int i = 0; i < n; i++) {
+        const std::string &a = args[i];
+        uint16_t value;
+        if (a.size() >= 2 && a[0] == '"' && a.back() == '"') {
+            std::string s = a.substr(1, a.size() - 2);
+            ram[desc] = s.size();
+            ram[desc + 1] = text & 0xff;
+            ram[desc + 2] = text >> 8;
+            memcpy(&ram[text], s.data(), s.size());
+            value = desc;
+            desc += 3;
+            text += s.size();
+        } else {
+            char *end;
+            value = a[0] == '&' ? strtoul(a.c_str() + 1, &end, 16) : strtoul(a.c_str(), &end, 10);
+            if (a.empty() || *end) return false;
+        }
+        uint16_t at = PARAM_BLOCK + 2 * (n - 1 - i);
+        ram[at] = value & 0xff;
+        ram[at + 1] = value >> 8;
+    }
+    cpu.a = n;
+    cpu.ix = PARAM_BLOCK;
+    return true;
+}
+
+// count the responses published in the control ROM's response buffer
+static void count_responses(void) {
+    uint8_t seq = UPPER_ROMS[control_bank][RESP_BUF + RESP_SEQ];
+    counts->round_trips += (uint8_t)(seq - last_seq);
+    last_seq = seq;
+}
+
+// Run one RSX call such as ROMS, LED,1 or PDIR,"/" with the control ROM selected, as the
+// firmware's KL does for |ROMS, until it returns, the firmware resets the CPC or the limit
+static bool rsx_run(const std::string &line, rsx_result_t *r) {
+    std::vector<std::string> args;
+    size_t start = 0;
+    bool quoted = false;
+    for (size_t i = 0; i <= line.size(); i++) {
+        if (i < line.size() && line[i] == '"') quoted = !quoted;
+        if (i == line.size() || (line[i] == ',' && !quoted)) {
+            args.push_back(line.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    std::string name = args[0];
+    args.erase(args.begin());
+    uint16_t entry = rsx_entry(name.c_str());
+    if (!entry) {
+        fprintf(stderr, "hostsim: no RSX |%s\n", name.c_str());
+        return false;
+    }
+    memset(r, 0, sizeof(*r));
+    // the ROM select is the firmware's, not counted against the RSX
+    counts = NULL;
+    latch_write(control_bank);
+    if (!rsx_params(args)) {
+        fprintf(stderr, "hostsim: bad parameters for |%s\n", name.c_str());
+        return false;
+    }
+    cpu.sp = RAM_TOP;
+    push(RETURN_ADDRESS);
+    cpu.pc = entry;
+    counts = r;
+    last_seq = UPPER_ROMS[control_bank][RESP_BUF + RESP_SEQ];
+    uint32_t resets = hostsim_outputs(RESET_GPIO);
+    uint32_t commands = latch_commands;
+    uint32_t quarter = 0;   // T-states not yet counted in the microsecond clock
+    while (cpu.pc != RETURN_ADDRESS) {
+        if (cpu.pc == 0xbb5a) {         // TXT_OUTPUT
+            screen += (char)cpu.a;
+            cpu.pc = pop();
+            continue;
+        }
+        if (cpu.pc == 0xbb18) {         // KM_WAIT_KEY
+            r->keys++;
+            cpu.a = ' ';
+            cpu.pc = pop();
+            continue;
+        }
+        if (cpu.pc >= 0xb900 && cpu.pc < 0xc000) {
+            fprintf(stderr, "hostsim: |%s called &%04X, which isn't modelled\n", name.c_str(), cpu.pc);
+            return false;
+        }
+        int t = z80_step(&cpu);
+        r->tstates += t;
+        quarter += t;
+        hostsim_advance_us(quarter / 4);
+        quarter %= 4;
+        hostsim_core0_run();
+        count_responses();
+        if (hostsim_outputs(RESET_GPIO) != resets) {
+            r->reset = true;
+            break;
+        }
+        if (r->tstates > TSTATE_LIMIT) {
+            r->timeout = true;
+            break;
+        }
+    }
+    // a reset lets core 0 finish the command, and the CPC then starts again
+    hostsim_core0_run();
+    count_responses();
+    r->commands = latch_commands - commands;
+    counts = NULL;
+    return true;
+}
+
+static const char *loop_name(void) {
+    void (*loop)(void) = hostsim_core1_entry();
+    if (loop == emulate_lower_only) return "lower only";
+    if (loop == emulate_single) return "single";
+    if (loop == emulate_banked) return "banked";
+    if (loop == emulate_interp) return "interp";
+    return "none";
+}
+
+// drive setup, as mkdrive
+
+static void fail(const char *what, const char *path, FRESULT res) {
+    fprintf(stderr, "hostsim: %s %s failed (FatFs error %d)\n", what, path, res);
+    exit(1);
+}
+
+static void copy_file(const char *src, const std::string &dest) {
+    FILE *in = fopen(src, "rb");
+    FIL fp;
+    FRESULT res;
+    UINT bw;
+    size_t n;
+
+    if (!in) {
+        perror(src);
+        exit(1);
+    }
+    res = f_open(&fp, dest.c_str(), FA_CREATE_ALWAYS|FA_WRITE);
+    if (res) fail("create", dest.c_str(), res);
+    while ((n = fread(psave_buf, 1, sizeof(psave_buf), in)) > 0) {
+        res = f_write(&fp, psave_buf, n, &bw);
+        if (res || bw != n) fail("write", dest.c_str(), res);
+    }
+    fclose(in);
+    res = f_close(&fp);
+    if (res) fail("close", dest.c_str(), res);
+}
+
+// nftw() callback, <dirent.h> can't be used as FatFs has its own DIR
+static size_t walk_root;
+
+static int copy_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    if (ftw->level == 0) return 0;
+    std::string dest = path + walk_root + 1;
+    if (dest[0] == '.' || dest.find("/.") != std::string::npos) return 0;
+    if (type == FTW_D) {
+        FRESULT res = f_mkdir(dest.c_str());
+        if (res && res != FR_EXIST) fail("mkdir", dest.c_str(), res);
+    } else if (type == FTW_F) {
+        copy_file(path, dest);
+    }
+    return 0;
+}
+
+static std::string copy_path(const char *src) {
+    struct stat st;
+    if (stat(src, &st) != 0) {
+        perror(src);
+        exit(1);
+    }
+    if (S_ISDIR(st.st_mode)) {
+        walk_root = strlen(src);
+        while (walk_root > 1 && src[walk_root - 1] == '/') walk_root--;
+        if (nftw(src, copy_entry, 16, 0) != 0) {
+            perror(src);
+            exit(1);
+        }
+        return "";
+    }
+    const char *name = strrchr(src, '/');
+    copy_file(src, name ? name + 1 : src);
+    return name ? name + 1 : src;
+}
+
+static std::string rom_name;                // picorom.rom as copied to the drive
+static std::vector<std::string> config;     // DEFAULT.CFG lines after the control ROM's
+
+// Format and fill the drive, boot the firmware as cpc_mode() does on a CPC, and run core 0 up
+// to its first wait for the latch
+static void boot(int argc, char **argv, const char *shape) {
+    FIL fp;
+    flash_format();
+    format();
+    rom_name = copy_path(argv[0]);
+    for (int i = 1; i < argc; i++) copy_path(argv[i]);
+    if (f_open(&fp, "DEFAULT.CFG", FA_CREATE_ALWAYS|FA_WRITE)) fail("create", "DEFAULT.CFG", FR_DENIED);
+    f_printf(&fp, "%d %s\n", control_bank, rom_name.c_str());
+    for (size_t i = 0; i < config.size(); i++) f_printf(&fp, "%s\n", config[i].c_str());
+    f_close(&fp);
+    f_unmount("");
+    for (int i = PSAVE_DATA; i < 0x8000; i++) ram[i] = i ^ (i >> 8);
+    cpu.ctx = NULL;
+    cpu.read = cpc_read;
+    cpu.write = cpc_write;
+    cpu.in = cpc_in;
+    cpu.out = cpc_out;
+    z80_reset(&cpu);
+    hostsim_core0_start(cpc_mode);
+    if (!(upper_roms & (1 << control_bank))) {
+        fprintf(stderr, "hostsim: %s didn't load into bank %d\n", rom_name.c_str(), control_bank);
+        exit(1);
+    }
+    if (!shape) return;
+    void (*loop)(void) = !strcmp(shape, "banked") ? emulate_banked : !strcmp(shape, "interp") ? emulate_interp :
+        !strcmp(shape, "single") ? emulate_single : NULL;
+    if (!loop || (loop == emulate_single && (upper_roms & (upper_roms - 1)))) {
+        fprintf(stderr, "hostsim: no %s bus loop for ROMs %04x\n", shape, upper_roms);
+        exit(1);
+    }
+    // with the CPC in reset, as start_bus_loop() does
+    multicore_reset_core1();
+    multicore_launch_core1(loop);
+}
+
+static std::vector<std::string> default_suite(void) {
+    std::string rom = "\"" + rom_name + "\"";
+    return {
+        "ROMS", "PDIR", "PDIR,\"/\"", "ROMFIND,\"PICO\"", "LED,1", "LED,0", "PBOOT", "PLOG",
+        "PSAVE,\"TEST.BIN\",&4000,&1000", "PDIR,\"/\"", "PROFILE", "LATENCY", "PTRACE",
+        "ROMIN,3," + rom, "ROMS", "ROMOUT,3", "ROMS",
+    };
+}
+
+// Run the RSXs, print a line of counts for each, and what they printed with -v or to text
+static int run_suite(const std::vector<std::string> &suite, FILE *text) {
+    int failed = 0;
+    printf("bus loop %s, ROMs %04x\n\n", loop_name(), upper_roms);
+    printf("%-32s %10s %6s %5s %6s %6s %9s %s\n", "RSX", "T-states", "latch", "cmds", "trips", "polls", "ROM reads",
+        "bus loop after");
+    for (size_t i = 0; i < suite.size(); i++) {
+        rsx_result_t r;
+        screen.clear();
+        if (!rsx_run(suite[i], &r)) {
+            failed++;
+            continue;
+        }
+        printf("|%-31s %10llu %6u %5u %6u %6u %9llu %s%s%s%s\n", suite[i].c_str(),
+            (unsigned long long)r.tstates, r.latch_bytes, r.commands, r.round_trips, r.polls,
+            (unsigned long long)r.rom_reads, loop_name(), r.reset ? " CPC reset" : "",
+            r.timeout ? " TIMEOUT" : "", r.lost ? " LOST LATCH BYTES" : "");
+        if (r.timeout || r.lost) failed++;
+        std::string shown;
+        for (char c : screen) if (c != '\r') shown += c;
+        if (verbose) printf("%s", shown.c_str());
+        if (text) fprintf(text, "|%s\n%s", suite[i].c_str(), shown.c_str());
+    }
+    if (hostsim_latch_underflows()) {
+        printf("%u latch FIFO reads while it was empty\n", hostsim_latch_underflows());
+        failed++;
+    }
+    return failed;
+}
+
+// Bus loop check: fill the banks with patterns, then read every address of the lower ROM and of
+// each select through one shape. Each select must take effect on the next ROMEN high pass, and
+// the data bus must be released for an unloaded bank even straight after a lower ROM read.
+// Also counts the SIO accesses (one cycle each) of the ROMEN low passes that read the lower ROM
+// and a loaded upper ROM, to compare what the shapes spend on GPIO and interpolator registers.
+static int sweep(const char *name, void (*loop)(void), uint16_t loaded) {
+    uint32_t errors = 0, slow = 0, passes = 0;
+    uint64_t sio[2] = { 0, 0 }, reads[2] = { 0, 0 };
+    for (int b = 0; b < NUM_ROM_BANKS; b++) {
+        for (int a = 0; a < ROM_SIZE; a++) UPPER_ROMS[b][a] = (a * 7 + b * 29 + (a >> 8)) & 0xff;
+    }
+    for (int a = 0; a < ROM_SIZE; a++) LOWER_ROM[a] = (a ^ (a >> 8) ^ 0x5a) & 0xff;
+    upper_roms = loaded;
+    rom_bank = NO_ROM;
+    single_bank = loaded ? __builtin_ctz(loaded) : 0;
+    multicore_reset_core1();
+    multicore_launch_core1(loop);
+    // selects of every bank, past NUM_ROM_BANKS and the ignored values
+    for (int sel = 0; sel < 0x100; sel++) {
+        if (sel > 16 && sel < 0xfd) continue;
+        if (sel == CMD_PREFIX_BYTE) continue;
+        int expect = sel < NUM_ROM_BANKS && (loaded & (1 << sel)) ? sel : NO_ROM;
+        if (sel >= 0xfd) expect = rom_bank;
+        hostsim_latch_write(sel);
+        passes = 0;
+        while (hostsim_latch_level()) {
+            hostsim_bus_pass(ROMEN_MASK);
+            passes++;
+        }
+        if (passes != 1) slow++;
+        for (int a = 0; a < ROM_SIZE; a++) {
+            for (int upper = 0; upper < 2; upper++) {
+                uint64_t before = hostsim_sio_accesses();
+                hostsim_bus_pass(a | (upper ? A15_MASK : 0));
+                if (!upper || (expect != NO_ROM && loop != emulate_lower_only)) {
+                    sio[upper] += hostsim_sio_accesses() - before;
+                    reads[upper]++;
+                }
+                bool driven = (hostsim_pins_dir() & DATA_BUS_MASK) == DATA_BUS_MASK;
+                uint8_t data = (hostsim_pins_out() & DATA_BUS_MASK) >> 14;
+                hostsim_bus_pass(ROMEN_MASK);
+                if (!upper) {
+                    if (!driven || data != LOWER_ROM[a]) errors++;
+                } else if (expect == NO_ROM || loop == emulate_lower_only) {
+                    if (driven) errors++;
+                } else if (!driven || data != UPPER_ROMS[expect][a]) {
+                    errors++;
+                }
+            }
+            // an upper read straight after a lower one, without a ROMEN high pass between them
+            hostsim_bus_pass(a);
+            hostsim_bus_pass(a | A15_MASK);
+            bool driven = (hostsim_pins_dir() & DATA_BUS_MASK) == DATA_BUS_MASK;
+            hostsim_bus_pass(ROMEN_MASK);
+            if (driven != (expect != NO_ROM && loop != emulate_lower_only)) errors++;
+        }
+    }
+    char upper[16] = "-";
+    if (reads[1]) snprintf(upper, sizeof(upper), "%.2f", (double)sio[1] / reads[1]);
+    printf("%-10s ROMs %04x: %u wrong reads, %u selects not applied on the next pass, SIO per read: "
+        "lower %.2f upper %s\n", name, loaded, errors, slow, (double)sio[0] / reads[0], upper);
+    return errors + slow;
+}
+
+static int sweep_all(void) {
+    uint16_t all = (1 << NUM_ROM_BANKS) - 1;
+    int failed = 0;
+    failed += sweep("lower only", emulate_lower_only, 0);
+    failed += sweep("single", emulate_single, 1 << control_bank);
+    failed += sweep("banked", emulate_banked, all & 0x5555);
+    failed += sweep("interp", emulate_interp, all & 0x5555);
+    failed += sweep("banked", emulate_banked, all);
+    failed += sweep("interp", emulate_interp, all);
+    if (hostsim_latch_underflows()) failed++;
+    return failed;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: hostsim [options] picorom.rom [file|directory ...]\n"
+        "  Formats a RAM drive, copies picorom.rom and the files to it as mkdrive does, with a\n"
+        "  DEFAULT.CFG loading picorom.rom into the control bank, boots the firmware and runs\n"
+        "  the RSXs on the modelled CPC. T-states are at 4 per microsecond of CPC time.\n"
+        "  -x rsx          run this RSX instead of the default set, e.g. -x ROMS -x 'PDIR,\"/\"'\n"
+        "  -b bank         control bank for picorom.rom (default %d)\n"
+        "  -u bank:file    also load a copied file into an upper bank\n"
+        "  -l file         load a copied file as the lower ROM\n"
+        "  -s shape        run the RSXs with the single, banked or interp bus loop\n"
+        "  -c              compare: run the RSXs with each bus loop and check they print the\n"
+        "                  same, and sweep every ROM address through every bus loop\n"
+        "  -v              show what the RSXs print\n",
+        control_bank);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> suite;
+    const char *shape = NULL;
+    bool compare = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:b:u:l:s:cv")) != -1) {
+        switch (opt) {
+            case 'x': suite.push_back(optarg); break;
+            case 'b': control_bank = atoi(optarg); break;
+            case 'u': {
+                std::string u = optarg;
+                size_t colon = u.find(':');
+                if (colon == std::string::npos) usage();
+                config.push_back(u.substr(0, colon) + " " + u.substr(colon + 1));
+                break;
+            }
+            case 'l': config.push_back(std::string("L ") + optarg); break;
+            case 's': shape = optarg; break;
+            case 'c': compare = true; break;
+            case 'v': verbose = 1; break;
+            default: usage();
+        }
+    }
+    if (optind >= argc || control_bank < 0 || control_bank >= NUM_ROM_BANKS) usage();
+    if (!compare) {
+        boot(argc - optind, argv + optind, shape);
+        if (suite.empty()) suite = default_suite();
+        return run_suite(suite, NULL) ? 1 : 0;
+    }
+
+    // each shape gets a freshly booted firmware in its own process
+    const char *shapes[] = { "single", "banked", "interp" };
+    std::string first;
+    int failed = 0;
+    bool one_rom = true;
+    for (size_t i = 0; i < config.size(); i++) {
+        if (config[i][0] != 'L') one_rom = false;
+    }
+    for (const char *s : shapes) {
+        if (!strcmp(s, "single") && !one_rom) continue;
+        int fd[2];
+        if (pipe(fd)) {
+            perror("pipe");
+            exit(1);
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fd[0]);
+            FILE *text = fdopen(fd[1], "w");
+            boot(argc - optind, argv + optind, s);
+            if (suite.empty()) suite = default_suite();
+            int f = run_suite(suite, text);
+            fclose(text);
+            fflush(stdout);
+            _exit(f ? 1 : 0);
+        }
+        close(fd[1]);
+        std::string out;
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd[0], buf, sizeof(buf))) > 0) out.append(buf, n);
+        close(fd[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) failed++;
+        if (first.empty()) {
+            first = out;
+        } else if (out != first) {
+            printf("%s: the RSXs printed something else than with the %s loop\n", s, one_rom ? "single" : "banked");
+            failed++;
+        }
+        printf("\n");
+    }
+    failed += sweep_all();
+    printf("%s\n", failed ? "FAILED" : "all bus loops agree");
+    return failed ? 1 : 0;
+}
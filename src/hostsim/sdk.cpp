@@ -0,0 +1,288 @@
+// Pico SDK model for hostsim, see sdk/pico_host.h
+// Core 1 and core 0 are ucontext coroutines run from hostsim.cpp. Core 1 gives control back
+// each time its bus loop reads the pins, so hostsim_bus_pass() is one pass of the loop. Core 0
+// gives it back in tud_task(), which latch_poll() calls each time round while waiting for the
+// latch, so hostsim_core0_run() lets a command run up to its next wait.
+#include <ucontext.h>
+#include <stdlib.h>
+#include <deque>
+#include "pico_host.h"
+
+#define LATCH_FIFO_DEPTH    8       // the latch SM joins the FIFOs
+#define CORE_STACK_SIZE     (1024 * 1024)
+#define NUM_GPIOS           30
+
+enum { CTX_MAIN, CTX_CORE0, CTX_CORE1 };
+
+static uint64_t now_us;
+static uint32_t sys_khz = 125000;
+static uint32_t pins_in, pins_out, pins_dir;
+static uint64_t sio_accesses;  // by core 1, see hostsim_sio_accesses()
+static uint32_t outputs[NUM_GPIOS];
+
+static ucontext_t main_ctx, core0_ctx, core1_ctx;
+static uint8_t core0_stack[CORE_STACK_SIZE], core1_stack[CORE_STACK_SIZE];
+static int running = CTX_MAIN;
+static void (*core0_entry)(void), (*core1_entry)(void);
+static bool core0_started, core1_launched, core1_in_pass;
+
+static pio_hw_t pio0_hw, pio1_hw;
+pio_hw_t *pio0 = &pio0_hw;
+pio_hw_t *pio1 = &pio1_hw;
+static std::deque<uint32_t> rx_fifo[4];
+static uint32_t underflows;
+
+static interp_hw_t interp0_hw, interp1_hw;
+interp_hw_t *interp0 = &interp0_hw;
+interp_hw_t *interp1 = &interp1_hw;
+
+static ioqspi_hw_t ioqspi;
+static sio_hw_t sio = { 0xffffffff };   // BOOTSEL not pressed
+static io_bank0_hw_t io_bank0;
+static xip_ctrl_hw_t xip_ctrl;
+static bus_ctrl_hw_t bus_ctrl;
+ioqspi_hw_t *ioqspi_hw = &ioqspi;
+sio_hw_t *sio_hw = &sio;
+io_bank0_hw_t *io_bank0_hw = &io_bank0;
+xip_ctrl_hw_t *xip_ctrl_hw = &xip_ctrl;
+bus_ctrl_hw_t *bus_ctrl_hw = &bus_ctrl;
+
+// time
+void hostsim_advance_us(uint64_t us) { now_us += us; }
+uint32_t time_us_32(void) { return (uint32_t)now_us; }
+uint64_t time_us_64(void) { return now_us; }
+absolute_time_t get_absolute_time(void) { return now_us; }
+uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+absolute_time_t make_timeout_time_ms(uint32_t ms) { return now_us + (uint64_t)ms * 1000; }
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) { return (int64_t)(to - from); }
+bool time_reached(absolute_time_t t) { return now_us >= t; }
+void sleep_ms(uint32_t ms) { now_us += (uint64_t)ms * 1000; }
+void sleep_us(uint64_t us) { now_us += us; }
+void busy_wait_us(uint64_t us) { now_us += us; }
+uint get_core_num(void) { return running == CTX_CORE1; }
+
+uint32_t save_and_disable_interrupts(void) { return 0; }
+void restore_interrupts(uint32_t status) { (void)status; }
+
+static inline void sio_access(uint n) {
+    if (running == CTX_CORE1) sio_accesses += n;
+}
+uint64_t hostsim_sio_accesses(void) { return sio_accesses; }
+
+// GPIO. Pins driven by the Pico read back what it drives. The SIO accesses are those of the SDK's
+// inline functions: gpio_put_masked() reads GPIO_OUT and writes GPIO_TOGL, the others are one each
+uint32_t gpio_get_all(void) {
+    if (running == CTX_CORE1) {
+        // the loop is back at the top, that was one pass
+        if (core1_in_pass) {
+            core1_in_pass = false;
+            running = CTX_MAIN;
+            swapcontext(&core1_ctx, &main_ctx);
+        }
+        core1_in_pass = true;
+    }
+    sio_access(1);
+    return (pins_in & ~pins_dir) | (pins_out & pins_dir);
+}
+bool gpio_get(uint gpio) { return (gpio_get_all() >> gpio) & 1; }
+void gpio_put(uint gpio, bool value) { gpio_put_masked(1u << gpio, (uint32_t)value << gpio); }
+void gpio_put_masked(uint32_t mask, uint32_t value) {
+    sio_access(2);
+    pins_out = (pins_out & ~mask) | (value & mask);
+}
+void gpio_set_dir_out_masked(uint32_t mask) {
+    sio_access(1);
+    for (uint i = 0; i < NUM_GPIOS; i++) {
+        if ((mask & ~pins_dir) & (1u << i)) outputs[i]++;
+    }
+    pins_dir |= mask;
+}
+void gpio_set_dir_in_masked(uint32_t mask) {
+    sio_access(1);
+    pins_dir &= ~mask;
+}
+void gpio_set_dir(uint gpio, bool out) {
+    if (out) gpio_set_dir_out_masked(1u << gpio);
+    else gpio_set_dir_in_masked(1u << gpio);
+}
+void gpio_init(uint gpio) { gpio_init_mask(1u << gpio); }
+void gpio_init_mask(uint32_t mask) {
+    pins_dir &= ~mask;
+    pins_out &= ~mask;
+}
+void gpio_pull_up(uint gpio) { (void)gpio; }
+void gpio_pull_down(uint gpio) { (void)gpio; }
+void gpio_acknowledge_irq(uint gpio, uint32_t events) { (void)gpio; (void)events; }
+
+uint32_t hostsim_pins_out(void) { return pins_out; }
+uint32_t hostsim_pins_dir(void) { return pins_dir; }
+uint32_t hostsim_outputs(uint gpio) { return outputs[gpio]; }
+
+uint32_t clock_get_hz(enum clock_index clk) { return clk == clk_sys ? sys_khz * 1000 : 12000000; }
+bool set_sys_clock_khz(uint32_t khz, bool required) {
+    (void)required;
+    sys_khz = khz;
+    return true;
+}
+bool check_sys_clock_khz(uint32_t khz, uint *vco, uint *postdiv1, uint *postdiv2) {
+    (void)khz; (void)vco; (void)postdiv1; (void)postdiv2;
+    return true;
+}
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {
+    (void)delay_ms; (void)pause_on_debug;
+    fprintf(stderr, "hostsim: watchdog reboot\n");
+    exit(1);
+}
+bool stdio_init_all(void) { return true; }
+void board_init(void) {}
+
+// tinyusb, no host. tud_task() is where core 0 waits, so it yields
+static bool usb_inited;
+void tud_init(uint8_t rhport) { (void)rhport; usb_inited = true; }
+bool tud_inited(void) { return usb_inited; }
+void tud_task(void) {
+    if (running != CTX_CORE0) return;
+    running = CTX_MAIN;
+    swapcontext(&core0_ctx, &main_ctx);
+}
+bool tud_connect(void) { return true; }
+bool tud_disconnect(void) { return true; }
+bool tud_cdc_connected(void) { return false; }
+
+// cores
+static void core0_start(void) {
+    core0_entry();
+    fprintf(stderr, "hostsim: core 0 returned\n");
+    exit(1);
+}
+
+static void core1_start(void) {
+    core1_entry();
+    fprintf(stderr, "hostsim: core 1 returned\n");
+    exit(1);
+}
+
+static void make_core(ucontext_t *ctx, uint8_t *stack, void (*start)(void)) {
+    getcontext(ctx);
+    ctx->uc_stack.ss_sp = stack;
+    ctx->uc_stack.ss_size = CORE_STACK_SIZE;
+    ctx->uc_link = NULL;
+    makecontext(ctx, start, 0);
+}
+
+// core 1's context is dropped, as on the chip, where it is held in reset
+void multicore_reset_core1(void) { core1_launched = false; }
+
+void multicore_launch_core1(void (*entry)(void)) {
+    core1_entry = entry;
+    core1_in_pass = false;
+    make_core(&core1_ctx, core1_stack, core1_start);
+    core1_launched = true;
+}
+
+void (*hostsim_core1_entry(void))(void) { return core1_launched ? core1_entry : NULL; }
+
+bool hostsim_bus_pass(uint32_t pins) {
+    if (!core1_launched) return false;
+    pins_in = pins;
+    int from = running;
+    running = CTX_CORE1;
+    swapcontext(&main_ctx, &core1_ctx);
+    running = from;
+    return true;
+}
+
+void hostsim_core0_start(void (*entry)(void)) {
+    core0_entry = entry;
+    make_core(&core0_ctx, core0_stack, core0_start);
+    core0_started = true;
+    hostsim_core0_run();
+}
+
+void hostsim_core0_run(void) {
+    if (!core0_started) return;
+    running = CTX_CORE0;
+    swapcontext(&main_ctx, &core0_ctx);
+    running = CTX_MAIN;
+}
+
+// PIO, just the latch SM's RX FIFO
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+    (void)pio; (void)program;
+    return 0;
+}
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) { (void)pio; (void)sm; (void)enabled; }
+
+static uint32_t rx_pop(uint sm) {
+    if (rx_fifo[sm].empty()) {
+        underflows++;
+        return 0;
+    }
+    uint32_t v = rx_fifo[sm].front();
+    rx_fifo[sm].pop_front();
+    return v;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) { return pio != pio0 || rx_fifo[sm].empty(); }
+uint32_t pio_sm_get(PIO pio, uint sm) { return pio == pio0 ? rx_pop(sm) : 0; }
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) { return pio == pio0 ? rx_fifo[sm].size() : 0; }
+
+pio_rxf_reg_t::operator uint32_t() const { return rx_pop(this - pio0_hw.rxf); }
+
+pio_fstat_reg_t::operator uint32_t() const {
+    uint32_t fstat = 0;
+    if (this != &pio0_hw.fstat) return 0x0f0f0f00;   // pio1 is idle
+    for (uint sm = 0; sm < 4; sm++) {
+        if (rx_fifo[sm].empty()) fstat |= 1u << (PIO_FSTAT_RXEMPTY_LSB + sm);
+        if (rx_fifo[sm].size() >= LATCH_FIFO_DEPTH) fstat |= 1u << sm;     // RXFULL
+        fstat |= 1u << (24 + sm);   // TXEMPTY
+    }
+    return fstat;
+}
+
+bool hostsim_latch_write(uint8_t value) {
+    // the SM stalls on a full FIFO and the latch is written over, the byte is lost
+    if (rx_fifo[0].size() >= LATCH_FIFO_DEPTH) {
+        pio0_hw.fdebug.bits |= 1u << PIO_FDEBUG_RXSTALL_LSB;
+        return false;
+    }
+    rx_fifo[0].push_back(value);
+    return true;
+}
+uint hostsim_latch_level(void) { return rx_fifo[0].size(); }
+uint32_t hostsim_latch_underflows(void) { return underflows; }
+
+// interpolator, see the comment in pico_host.h. ADD_RAW only changes the lane's own PEEK
+static uint32_t lane_result(const interp_hw_t *hw, int lane, bool add_raw) {
+    uint32_t ctrl = hw->ctrl[lane];
+    uint32_t input = (uint32_t)hw->accum[(ctrl & SIO_INTERP0_CTRL_LANE0_CROSS_INPUT_BITS) ? !lane : lane].value;
+    if (add_raw && (ctrl & SIO_INTERP0_CTRL_LANE0_ADD_RAW_BITS)) return input;
+    uint shift = (ctrl & SIO_INTERP0_CTRL_LANE0_SHIFT_BITS) >> SIO_INTERP0_CTRL_LANE0_SHIFT_LSB;
+    uint lsb = (ctrl & SIO_INTERP0_CTRL_LANE0_MASK_LSB_BITS) >> SIO_INTERP0_CTRL_LANE0_MASK_LSB_LSB;
+    uint msb = (ctrl & SIO_INTERP0_CTRL_LANE0_MASK_MSB_BITS) >> SIO_INTERP0_CTRL_LANE0_MASK_MSB_LSB;
+    uint32_t mask = (0xffffffffu >> (31 - msb)) & (0xffffffffu << lsb);
+    uint32_t v = (input >> shift) & mask;
+    if ((ctrl & SIO_INTERP0_CTRL_LANE0_SIGNED_BITS) && msb < 31 && (v >> msb) & 1) {
+        v |= 0xffffffffu << (msb + 1);
+    }
+    return v;
+}
+
+interp_reg_t::operator uintptr_t() const {
+    sio_access(1);
+    return value;
+}
+interp_reg_t &interp_reg_t::operator=(uintptr_t v) {
+    sio_access(1);
+    value = v;
+    return *this;
+}
+
+interp_peek_reg_t::operator uintptr_t() const {
+    bool first = this >= interp0_hw.peek && this < interp0_hw.peek + 3;
+    const interp_hw_t *hw = first ? &interp0_hw : &interp1_hw;
+    int i = this - hw->peek;
+    sio_access(1);
+    if (i < 2) return hw->base[i].value + lane_result(hw, i, true);
+    return hw->base[2].value + lane_result(hw, 0, false) + lane_result(hw, 1, false);
+}
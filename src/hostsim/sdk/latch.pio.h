@@ -0,0 +1,9 @@
+// the latch SM is modelled by its RX FIFO, see hostsim_latch_write()
+#include "pico_host.h"
+
+static const pio_program_t latch_program = { NULL, 0, -1 };
+
+static inline void latch_program_init(PIO pio, uint sm, uint offset) {
+    (void)offset;
+    pio_sm_set_enabled(pio, sm, true);
+}
@@ -0,0 +1,283 @@
+#ifndef _PICO_HOST_H_
+#define _PICO_HOST_H_
+
+// The parts of the Pico SDK the firmware uses, for hostsim. Every SDK header the firmware
+// includes is a file in this directory that includes this one. Time is the simulated CPC time,
+// the GPIO pins are driven by the Z80 side of hostsim, and core 1 and core 0 are coroutines, see
+// sdk.cpp. The PIO RX FIFO and the interpolator are modelled with registers that act on being
+// read, so main.c is built as C++ and the firmware's own register accesses drive the models.
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+#define __not_in_flash_func(f)          f
+#define __no_inline_not_in_flash_func(f) f
+#define __time_critical_func(f)         f
+#define __scratch_x(s)
+#define __scratch_y(s)
+#define count_of(a)     (sizeof(a) / sizeof((a)[0]))
+#ifndef MIN
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#endif
+
+#define PICO_DEFAULT_LED_PIN    25
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES   (2 * 1024 * 1024)
+#endif
+#define FLASH_PAGE_SIZE         256
+#define FLASH_SECTOR_SIZE       4096
+#define XIP_BASE                0x10000000
+#define XIP_NOCACHE_NOALLOC_BASE 0x13000000
+#define XIP_SRAM_BASE           0x15000000
+#define BOARD_TUD_RHPORT        0
+
+#define GPIO_IN                 false
+#define GPIO_OUT                true
+#define GPIO_IRQ_EDGE_FALL      0x4u
+#define GPIO_OVERRIDE_NORMAL    0
+#define GPIO_OVERRIDE_LOW       2
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_LSB    12
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_BITS   0x3000
+#define XIP_CTRL_EN_BITS        0x1
+#define XIP_STAT_FIFO_EMPTY_BITS 0x2
+#define BUSCTRL_BUS_PRIORITY_PROC1_BITS 0x10
+#define PIO_FSTAT_RXEMPTY_LSB   8
+#define PIO_FDEBUG_RXSTALL_LSB  0
+
+enum clock_index { clk_ref = 4, clk_sys = 5 };
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// time, in simulated CPC time, see hostsim_advance_us()
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+absolute_time_t get_absolute_time(void);
+uint32_t to_ms_since_boot(absolute_time_t t);
+absolute_time_t make_timeout_time_ms(uint32_t ms);
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to);
+bool time_reached(absolute_time_t t);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+void busy_wait_us(uint64_t us);
+uint get_core_num(void);
+
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+static inline void hw_set_bits(volatile uint32_t *addr, uint32_t mask) { *addr |= mask; }
+static inline void hw_clear_bits(volatile uint32_t *addr, uint32_t mask) { *addr &= ~mask; }
+static inline void hw_write_masked(volatile uint32_t *addr, uint32_t values, uint32_t mask) {
+    *addr = (*addr & ~mask) | (values & mask);
+}
+
+// GPIO, pins 0-29 as on the board, see main.c
+uint32_t gpio_get_all(void);
+bool gpio_get(uint gpio);
+void gpio_put(uint gpio, bool value);
+void gpio_put_masked(uint32_t mask, uint32_t value);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_dir_in_masked(uint32_t mask);
+void gpio_set_dir_out_masked(uint32_t mask);
+void gpio_init(uint gpio);
+void gpio_init_mask(uint32_t mask);
+void gpio_pull_up(uint gpio);
+void gpio_pull_down(uint gpio);
+void gpio_acknowledge_irq(uint gpio, uint32_t events);
+
+uint32_t clock_get_hz(enum clock_index clk);
+bool set_sys_clock_khz(uint32_t khz, bool required);
+bool check_sys_clock_khz(uint32_t khz, uint *vco, uint *postdiv1, uint *postdiv2);
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+bool stdio_init_all(void);
+void board_init(void);
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1(void);
+
+// tinyusb device side, nothing is connected
+void tud_init(uint8_t rhport);
+bool tud_inited(void);
+void tud_task(void);
+bool tud_connect(void);
+bool tud_disconnect(void);
+bool tud_cdc_connected(void);
+#ifdef __cplusplus
+}
+#endif
+
+typedef struct {
+    volatile uint32_t ctrl;
+} io_ctrl_t;
+typedef struct {
+    struct { volatile uint32_t status; volatile uint32_t ctrl; } io[6];
+} ioqspi_hw_t;
+typedef struct {
+    volatile uint32_t gpio_hi_in;
+} sio_hw_t;
+typedef struct {
+    volatile uint32_t intr[4];
+} io_bank0_hw_t;
+typedef struct {
+    volatile uint32_t ctrl;
+    volatile uint32_t flush;
+    volatile uint32_t stat;
+} xip_ctrl_hw_t;
+typedef struct {
+    volatile uint32_t priority;
+} bus_ctrl_hw_t;
+extern ioqspi_hw_t *ioqspi_hw;
+extern sio_hw_t *sio_hw;
+extern io_bank0_hw_t *io_bank0_hw;
+extern xip_ctrl_hw_t *xip_ctrl_hw;
+extern bus_ctrl_hw_t *bus_ctrl_hw;
+
+typedef struct {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+#ifdef __cplusplus
+// PIO RX FIFO register: a read takes the next entry, as on the chip
+struct pio_rxf_reg_t {
+    operator uint32_t() const;
+};
+// FSTAT, from the FIFO levels when read
+struct pio_fstat_reg_t {
+    operator uint32_t() const;
+};
+// FDEBUG, a write clears the bits written
+struct pio_fdebug_reg_t {
+    uint32_t bits;
+    operator uint32_t() const { return bits; }
+    pio_fdebug_reg_t &operator=(uint32_t clear) { bits &= ~clear; return *this; }
+};
+typedef const pio_rxf_reg_t io_ro_32;
+
+typedef struct {
+    volatile uint32_t ctrl;
+    pio_fstat_reg_t fstat;
+    pio_fdebug_reg_t fdebug;
+    volatile uint32_t flevel;
+    volatile uint32_t txf[4];
+    pio_rxf_reg_t rxf[4];
+} pio_hw_t;
+typedef pio_hw_t *PIO;
+extern pio_hw_t *pio0;
+extern pio_hw_t *pio1;
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+
+// Interpolator, behaviour as in the RP2040 datasheet 2.3.1.6. Each lane takes its accumulator
+// (or the other lane's with CROSS_INPUT), shifts it right by SHIFT, masks bits MASK_LSB to
+// MASK_MSB, sign extends with SIGNED, and PEEK gives BASE plus that, or BASE plus the raw
+// accumulator with ADD_RAW. PEEK2 is BASE2 plus both lanes, without ADD_RAW. Reading a PEEK register works the
+// lanes out from the current accumulators, as the hardware does every cycle.
+#define SIO_INTERP0_CTRL_LANE0_SHIFT_LSB        0
+#define SIO_INTERP0_CTRL_LANE0_SHIFT_BITS       0x0000001f
+#define SIO_INTERP0_CTRL_LANE0_MASK_LSB_LSB     5
+#define SIO_INTERP0_CTRL_LANE0_MASK_LSB_BITS    0x000003e0
+#define SIO_INTERP0_CTRL_LANE0_MASK_MSB_LSB     10
+#define SIO_INTERP0_CTRL_LANE0_MASK_MSB_BITS    0x00007c00
+#define SIO_INTERP0_CTRL_LANE0_SIGNED_BITS      0x00008000
+#define SIO_INTERP0_CTRL_LANE0_CROSS_INPUT_BITS 0x00010000
+#define SIO_INTERP0_CTRL_LANE0_CROSS_RESULT_BITS 0x00020000
+#define SIO_INTERP0_CTRL_LANE0_ADD_RAW_BITS     0x00040000
+
+// ACCUM and BASE, counted as SIO accesses when the firmware reads or writes them. They are as
+// wide as a pointer, as the firmware puts ROM addresses in BASE and reads ROM bytes straight
+// through PEEK; on the RP2040 a pointer is the register's 32 bits
+struct interp_reg_t {
+    uintptr_t value;
+    operator uintptr_t() const;
+    interp_reg_t &operator=(uintptr_t v);
+};
+struct interp_peek_reg_t {
+    operator uintptr_t() const;
+    template <typename T> operator T *() const { return (T *)(uintptr_t)*this; }
+};
+
+typedef struct {
+    interp_reg_t accum[2];
+    interp_reg_t base[3];
+    volatile uint32_t pop[3];
+    interp_peek_reg_t peek[3];
+    volatile uint32_t ctrl[2];
+    volatile uint32_t add_raw[2];
+    volatile uint32_t base01;
+} interp_hw_t;
+extern interp_hw_t *interp0;
+extern interp_hw_t *interp1;
+
+typedef struct {
+    uint32_t ctrl;
+} interp_config;
+
+static inline interp_config interp_default_config(void) {
+    interp_config c = { 31u << SIO_INTERP0_CTRL_LANE0_MASK_MSB_LSB };
+    return c;
+}
+static inline void interp_config_set_shift(interp_config *c, uint shift) {
+    c->ctrl = (c->ctrl & ~SIO_INTERP0_CTRL_LANE0_SHIFT_BITS) | (shift << SIO_INTERP0_CTRL_LANE0_SHIFT_LSB);
+}
+static inline void interp_config_set_mask(interp_config *c, uint lsb, uint msb) {
+    c->ctrl = (c->ctrl & ~(SIO_INTERP0_CTRL_LANE0_MASK_LSB_BITS | SIO_INTERP0_CTRL_LANE0_MASK_MSB_BITS)) |
+        (lsb << SIO_INTERP0_CTRL_LANE0_MASK_LSB_LSB) | (msb << SIO_INTERP0_CTRL_LANE0_MASK_MSB_LSB);
+}
+static inline void interp_config_set_signed(interp_config *c, bool on) {
+    c->ctrl = on ? c->ctrl | SIO_INTERP0_CTRL_LANE0_SIGNED_BITS : c->ctrl & ~SIO_INTERP0_CTRL_LANE0_SIGNED_BITS;
+}
+static inline void interp_config_set_cross_input(interp_config *c, bool on) {
+    c->ctrl = on ? c->ctrl | SIO_INTERP0_CTRL_LANE0_CROSS_INPUT_BITS : c->ctrl & ~SIO_INTERP0_CTRL_LANE0_CROSS_INPUT_BITS;
+}
+static inline void interp_config_set_cross_result(interp_config *c, bool on) {
+    c->ctrl = on ? c->ctrl | SIO_INTERP0_CTRL_LANE0_CROSS_RESULT_BITS : c->ctrl & ~SIO_INTERP0_CTRL_LANE0_CROSS_RESULT_BITS;
+}
+static inline void interp_config_set_add_raw(interp_config *c, bool on) {
+    c->ctrl = on ? c->ctrl | SIO_INTERP0_CTRL_LANE0_ADD_RAW_BITS : c->ctrl & ~SIO_INTERP0_CTRL_LANE0_ADD_RAW_BITS;
+}
+static inline void interp_set_config(interp_hw_t *interp, uint lane, const interp_config *c) {
+    interp->ctrl[lane] = c->ctrl;
+}
+#endif
+
+// hostsim side of the model, see sdk.cpp
+#ifdef __cplusplus
+extern "C" {
+#endif
+void hostsim_advance_us(uint64_t us);
+// one pass of the core 1 loop with these pins in, false if core 1 isn't running
+bool hostsim_bus_pass(uint32_t pins);
+// the bus loop core 1 was launched with
+void (*hostsim_core1_entry(void))(void);
+uint32_t hostsim_pins_out(void);
+uint32_t hostsim_pins_dir(void);
+// times the pin has been made an output
+uint32_t hostsim_outputs(uint gpio);
+// a CPC write to the latch, false if the FIFO was full and the byte was lost
+bool hostsim_latch_write(uint8_t value);
+uint hostsim_latch_level(void);
+// reads of the latch FIFO while it was empty
+uint32_t hostsim_latch_underflows(void);
+// SIO accesses by core 1 so far: GPIO and interpolator register reads and writes. Each takes one
+// cycle on the RP2040 (datasheet 2.3.1), the rest of the loop's instructions aren't modelled
+uint64_t hostsim_sio_accesses(void);
+// run entry as core 0, and let it run until it next waits for the latch
+void hostsim_core0_start(void (*entry)(void));
+void hostsim_core0_run(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
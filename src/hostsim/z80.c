@@ -0,0 +1,595 @@
+// Z80 interpreter for hostsim, see z80.h
+// Decoded by the x/y/z/p/q fields of the opcode. DD and FD prefixes swap HL for IX or IY, H and
+// L for their halves, and (HL) for (IX+d). T-states are those of the Zilog manual: a prefix adds
+// 4, and (IX+d) 8 more than (HL), except LD (IX+d),n which adds 5.
+#include "z80.h"
+
+#define S   Z80_S
+#define Z   Z80_Z
+#define Y   Z80_Y
+#define H   Z80_H
+#define X   Z80_X
+#define PV  Z80_PV
+#define N   Z80_N
+#define C   Z80_C
+
+static uint8_t sz53[256];   // S, Z and the undocumented X and Y flags of a result
+static uint8_t sz53p[256];  // the same with parity
+static bool tables_done;
+
+static void make_tables(void) {
+    for (int i=0;i<256;i++) {
+        int bits = 0;
+        for (int b=0;b<8;b++) bits += (i >> b) & 1;
+        sz53[i] = (i & (S|X|Y)) | (i ? 0 : Z);
+        sz53p[i] = sz53[i] | (bits & 1 ? 0 : PV);
+    }
+    tables_done = true;
+}
+
+static inline uint8_t rd(z80_t *z, uint16_t addr) { return z->read(z->ctx, addr); }
+static inline void wr(z80_t *z, uint16_t addr, uint8_t v) { z->write(z->ctx, addr, v); }
+static inline uint16_t rd16(z80_t *z, uint16_t addr) { return rd(z, addr) | rd(z, addr + 1) << 8; }
+static inline void wr16(z80_t *z, uint16_t addr, uint16_t v) { wr(z, addr, v); wr(z, addr + 1, v >> 8); }
+static inline uint8_t fetch(z80_t *z) { return rd(z, z->pc++); }
+static inline uint16_t fetch16(z80_t *z) { uint16_t v = rd16(z, z->pc); z->pc += 2; return v; }
+static inline void refresh(z80_t *z) { z->r = (z->r & 0x80) | ((z->r + 1) & 0x7f); }
+
+static inline uint16_t bc(z80_t *z) { return z->b << 8 | z->c; }
+static inline uint16_t de(z80_t *z) { return z->d << 8 | z->e; }
+static inline uint16_t hl(z80_t *z) { return z->h << 8 | z->l; }
+static inline void set_bc(z80_t *z, uint16_t v) { z->b = v >> 8; z->c = v; }
+static inline void set_de(z80_t *z, uint16_t v) { z->d = v >> 8; z->e = v; }
+static inline void set_hl(z80_t *z, uint16_t v) { z->h = v >> 8; z->l = v; }
+
+static void push(z80_t *z, uint16_t v) { z->sp -= 2; wr16(z, z->sp, v); }
+static uint16_t pop(z80_t *z) { uint16_t v = rd16(z, z->sp); z->sp += 2; return v; }
+
+// HL, IX or IY for idx 0, 1, 2
+static uint16_t get_xhl(z80_t *z, int idx) { return idx == 0 ? hl(z) : idx == 1 ? z->ix : z->iy; }
+static void set_xhl(z80_t *z, int idx, uint16_t v) {
+    if (idx == 0) set_hl(z, v); else if (idx == 1) z->ix = v; else z->iy = v;
+}
+
+// register r of the opcode (not 6), with H and L as the index halves when prefixed
+static uint8_t get_r(z80_t *z, int r, int idx) {
+    switch (r) {
+        case 0: return z->b;
+        case 1: return z->c;
+        case 2: return z->d;
+        case 3: return z->e;
+        case 4: return idx ? get_xhl(z, idx) >> 8 : z->h;
+        case 5: return idx ? get_xhl(z, idx) & 0xff : z->l;
+        default: return z->a;
+    }
+}
+
+static void set_r(z80_t *z, int r, int idx, uint8_t v) {
+    switch (r) {
+        case 0: z->b = v; break;
+        case 1: z->c = v; break;
+        case 2: z->d = v; break;
+        case 3: z->e = v; break;
+        case 4: if (idx) set_xhl(z, idx, (get_xhl(z, idx) & 0xff) | v << 8); else z->h = v; break;
+        case 5: if (idx) set_xhl(z, idx, (get_xhl(z, idx) & 0xff00) | v); else z->l = v; break;
+        default: z->a = v; break;
+    }
+}
+
+// BC, DE, HL/IX/IY, SP
+static uint16_t get_rp(z80_t *z, int p, int idx) {
+    switch (p) {
+        case 0: return bc(z);
+        case 1: return de(z);
+        case 2: return get_xhl(z, idx);
+        default: return z->sp;
+    }
+}
+
+static void set_rp(z80_t *z, int p, int idx, uint16_t v) {
+    switch (p) {
+        case 0: set_bc(z, v); break;
+        case 1: set_de(z, v); break;
+        case 2: set_xhl(z, idx, v); break;
+        default: z->sp = v; break;
+    }
+}
+
+static bool cond(z80_t *z, int y) {
+    switch (y) {
+        case 0: return !(z->f & Z);
+        case 1: return z->f & Z;
+        case 2: return !(z->f & C);
+        case 3: return z->f & C;
+        case 4: return !(z->f & PV);
+        case 5: return z->f & PV;
+        case 6: return !(z->f & S);
+        default: return z->f & S;
+    }
+}
+
+static void add8(z80_t *z, uint8_t v, int carry) {
+    unsigned res = z->a + v + carry;
+    z->f = sz53[res & 0xff] | ((res >> 8) & C) | ((z->a ^ v ^ res) & H) |
+        ((~(z->a ^ v) & (z->a ^ res) & 0x80) >> 5);
+    z->a = res;
+}
+
+static uint8_t sub8(z80_t *z, uint8_t v, int carry) {
+    unsigned res = z->a - v - carry;
+    z->f = N | sz53[res & 0xff] | ((res >> 8) & C) | ((z->a ^ v ^ res) & H) |
+        (((z->a ^ v) & (z->a ^ res) & 0x80) >> 5);
+    return res;
+}
+
+static void alu(z80_t *z, int op, uint8_t v) {
+    switch (op) {
+        case 0: add8(z, v, 0); break;
+        case 1: add8(z, v, z->f & C); break;
+        case 2: z->a = sub8(z, v, 0); break;
+        case 3: z->a = sub8(z, v, z->f & C); break;
+        case 4: z->a &= v; z->f = sz53p[z->a] | H; break;
+        case 5: z->a ^= v; z->f = sz53p[z->a]; break;
+        case 6: z->a |= v; z->f = sz53p[z->a]; break;
+        default: sub8(z, v, 0); z->f = (z->f & ~(X|Y)) | (v & (X|Y)); break;   // CP
+    }
+}
+
+static uint8_t inc8(z80_t *z, uint8_t v) {
+    uint8_t res = v + 1;
+    z->f = (z->f & C) | sz53[res] | ((res & 0xf) ? 0 : H) | (res == 0x80 ? PV : 0);
+    return res;
+}
+
+static uint8_t dec8(z80_t *z, uint8_t v) {
+    uint8_t res = v - 1;
+    z->f = (z->f & C) | N | sz53[res] | ((v & 0xf) ? 0 : H) | (v == 0x80 ? PV : 0);
+    return res;
+}
+
+static uint16_t add16(z80_t *z, uint16_t a, uint16_t v) {
+    uint32_t res = a + v;
+    z->f = (z->f & (S|Z|PV)) | ((res >> 16) & C) | ((res >> 8) & (X|Y)) | (((a ^ v ^ res) >> 8) & H);
+    return res;
+}
+
+static uint16_t adc16(z80_t *z, uint16_t a, uint16_t v) {
+    uint32_t res = a + v + (z->f & C);
+    z->f = ((res >> 16) & C) | ((res >> 8) & (S|X|Y)) | ((res & 0xffff) ? 0 : Z) |
+        (((a ^ v ^ res) >> 8) & H) | ((~(a ^ v) & (a ^ res) & 0x8000) >> 13);
+    return res;
+}
+
+static uint16_t sbc16(z80_t *z, uint16_t a, uint16_t v) {
+    uint32_t res = a - v - (z->f & C);
+    z->f = N | ((res >> 16) & C) | ((res >> 8) & (S|X|Y)) | ((res & 0xffff) ? 0 : Z) |
+        (((a ^ v ^ res) >> 8) & H) | (((a ^ v) & (a ^ res) & 0x8000) >> 13);
+    return res;
+}
+
+// CB rotates and shifts, y selects RLC RRC RL RR SLA SRA SLL SRL
+static uint8_t rot(z80_t *z, int y, uint8_t v) {
+    uint8_t carry;
+    switch (y) {
+        case 0: carry = v >> 7; v = v << 1 | carry; break;
+        case 1: carry = v & 1; v = v >> 1 | carry << 7; break;
+        case 2: carry = v >> 7; v = v << 1 | (z->f & C); break;
+        case 3: carry = v & 1; v = v >> 1 | (z->f & C) << 7; break;
+        case 4: carry = v >> 7; v = v << 1; break;
+        case 5: carry = v & 1; v = (v & 0x80) | v >> 1; break;
+        case 6: carry = v >> 7; v = v << 1 | 1; break;
+        default: carry = v & 1; v = v >> 1; break;
+    }
+    z->f = sz53p[v] | carry;
+    return v;
+}
+
+static void bit(z80_t *z, int y, uint8_t v) {
+    uint8_t res = v & (1 << y);
+    z->f = (z->f & C) | H | (v & (X|Y)) | (res ? (res & S) : (Z|PV));
+}
+
+static void daa(z80_t *z) {
+    uint8_t corr = 0, carry = z->f & C;
+    bool half;
+    if ((z->f & H) || (z->a & 0xf) > 9) corr |= 0x06;
+    if (carry || z->a > 0x99) { corr |= 0x60; carry = C; }
+    if (z->f & N) {
+        half = (z->f & H) && (z->a & 0xf) < 6;
+        z->a -= corr;
+    } else {
+        half = (z->a & 0xf) > 9;
+        z->a += corr;
+    }
+    z->f = sz53p[z->a] | (z->f & N) | carry | (half ? H : 0);
+}
+
+static int cb(z80_t *z, int idx) {
+    uint16_t addr = 0;
+    uint8_t op, v;
+    if (idx) {
+        // DD CB d op: the operand is always (IX+d), a register is also written for non BIT
+        addr = get_xhl(z, idx) + (int8_t)fetch(z);
+        op = fetch(z);
+        v = rd(z, addr);
+    } else {
+        op = fetch(z);
+        refresh(z);
+        v = (op & 7) == 6 ? rd(z, hl(z)) : get_r(z, op & 7, 0);
+    }
+    int x = op >> 6, y = (op >> 3) & 7, r = op & 7;
+    bool mem = idx || r == 6;
+    if (x == 1) {
+        bit(z, y, v);
+        return idx ? 16 : mem ? 12 : 8;
+    }
+    if (x == 0) v = rot(z, y, v);
+    else if (x == 2) v &= ~(1 << y);
+    else v |= 1 << y;
+    if (mem) wr(z, idx ? addr : hl(z), v);
+    if (!mem || (idx && r != 6)) set_r(z, r, 0, v);
+    return idx ? 19 : mem ? 15 : 8;
+}
+
+static int ed(z80_t *z) {
+    uint8_t op = fetch(z);
+    refresh(z);
+    int x = op >> 6, y = (op >> 3) & 7, zz = op & 7, p = y >> 1, q = y & 1;
+    if (x == 1) {
+        switch (zz) {
+            case 0: {   // IN r,(C)
+                uint8_t v = z->in(z->ctx, bc(z));
+                if (y != 6) set_r(z, y, 0, v);
+                z->f = (z->f & C) | sz53p[v];
+                return 12;
+            }
+            case 1:     // OUT (C),r
+                z->out(z->ctx, bc(z), y == 6 ? 0 : get_r(z, y, 0));
+                return 12;
+            case 2:
+                set_hl(z, q ? adc16(z, hl(z), get_rp(z, p, 0)) : sbc16(z, hl(z), get_rp(z, p, 0)));
+                return 15;
+            case 3: {
+                uint16_t nn = fetch16(z);
+                if (q) set_rp(z, p, 0, rd16(z, nn)); else wr16(z, nn, get_rp(z, p, 0));
+                return 20;
+            }
+            case 4: {   // NEG
+                uint8_t v = z->a;
+                z->a = 0;
+                z->a = sub8(z, v, 0);
+                return 8;
+            }
+            case 5:     // RETN, RETI
+                z->iff1 = z->iff2;
+                z->pc = pop(z);
+                return 14;
+            case 6:
+                z->im = (y & 3) == 2 ? 1 : (y & 3) == 3 ? 2 : 0;
+                return 8;
+            default:
+                switch (y) {
+                    case 0: z->i = z->a; return 9;
+                    case 1: z->r = z->a; return 9;
+                    case 2: z->a = z->i; z->f = (z->f & C) | sz53[z->a] | (z->iff2 ? PV : 0); return 9;
+                    case 3: z->a = z->r; z->f = (z->f & C) | sz53[z->a] | (z->iff2 ? PV : 0); return 9;
+                    case 4: {   // RRD
+                        uint8_t v = rd(z, hl(z));
+                        wr(z, hl(z), (z->a << 4) | (v >> 4));
+                        z->a = (z->a & 0xf0) | (v & 0x0f);
+                        z->f = (z->f & C) | sz53p[z->a];
+                        return 18;
+                    }
+                    case 5: {   // RLD
+                        uint8_t v = rd(z, hl(z));
+                        wr(z, hl(z), (v << 4) | (z->a & 0x0f));
+                        z->a = (z->a & 0xf0) | (v >> 4);
+                        z->f = (z->f & C) | sz53p[z->a];
+                        return 18;
+                    }
+                    default: return 8;
+                }
+        }
+    }
+    if (x == 2 && y >= 4 && zz <= 3) {
+        // block instructions, y = 4 increment, 5 decrement, 6 and 7 repeat
+        int step = (y & 1) ? -1 : 1;
+        bool repeat = y >= 6;
+        bool again = false;
+        switch (zz) {
+            case 0: {   // LDI LDD LDIR LDDR
+                uint8_t v = rd(z, hl(z));
+                wr(z, de(z), v);
+                set_hl(z, hl(z) + step);
+                set_de(z, de(z) + step);
+                set_bc(z, bc(z) - 1);
+                uint8_t n = v + z->a;
+                z->f = (z->f & (S|Z|C)) | (bc(z) ? PV : 0) | (n & X) | ((n << 4) & Y);
+                again = bc(z) != 0;
+                break;
+            }
+            case 1: {   // CPI CPD CPIR CPDR
+                uint8_t v = rd(z, hl(z));
+                uint8_t res = z->a - v;
+                uint8_t half = (z->a ^ v ^ res) & H;
+                set_hl(z, hl(z) + step);
+                set_bc(z, bc(z) - 1);
+                uint8_t n = res - (half ? 1 : 0);
+                z->f = (z->f & C) | N | (sz53[res] & ~(X|Y)) | half | (bc(z) ? PV : 0) | (n & X) | ((n << 4) & Y);
+                again = bc(z) != 0 && res != 0;
+                break;
+            }
+            case 2: {   // INI IND INIR INDR
+                wr(z, hl(z), z->in(z->ctx, bc(z)));
+                set_hl(z, hl(z) + step);
+                z->b--;
+                z->f = N | (z->b ? 0 : Z);
+                again = z->b != 0;
+                break;
+            }
+            default: {  // OUTI OUTD OTIR OTDR, B is decremented before the output
+                uint8_t v = rd(z, hl(z));
+                z->b--;
+                z->out(z->ctx, bc(z), v);
+                set_hl(z, hl(z) + step);
+                z->f = N | (z->b ? 0 : Z);
+                again = z->b != 0;
+                break;
+            }
+        }
+        if (repeat && again) {
+            z->pc -= 2;
+            return 21;
+        }
+        return 16;
+    }
+    return 8;   // the rest of ED is two byte NOPs
+}
+
+static int step(z80_t *z, uint8_t op, int idx) {
+    int x = op >> 6, y = (op >> 3) & 7, zz = op & 7, p = y >> 1, q = y & 1;
+    // (HL) operand, or (IX+d) with its displacement
+#define MEM_ADDR() (idx ? (uint16_t)(get_xhl(z, idx) + (int8_t)fetch(z)) : hl(z))
+#define MEM_EXTRA  (idx ? 8 : 0)
+    switch (x) {
+    case 0:
+        switch (zz) {
+        case 0:
+            switch (y) {
+                case 0: return 4;
+                case 1: {
+                    uint8_t t;
+                    t = z->a; z->a = z->a_; z->a_ = t;
+                    t = z->f; z->f = z->f_; z->f_ = t;
+                    return 4;
+                }
+                case 2: {
+                    int8_t d = fetch(z);
+                    if (--z->b) { z->pc += d; return 13; }
+                    return 8;
+                }
+                case 3: {
+                    int8_t d = fetch(z);
+                    z->pc += d;
+                    return 12;
+                }
+                default: {
+                    int8_t d = fetch(z);
+                    if (cond(z, y - 4)) { z->pc += d; return 12; }
+                    return 7;
+                }
+            }
+        case 1:
+            if (!q) { set_rp(z, p, idx, fetch16(z)); return 10; }
+            set_xhl(z, idx, add16(z, get_xhl(z, idx), get_rp(z, p, idx)));
+            return 11;
+        case 2:
+            switch (y) {
+                case 0: wr(z, bc(z), z->a); return 7;
+                case 1: wr(z, de(z), z->a); return 7;
+                case 2: wr16(z, fetch16(z), get_xhl(z, idx)); return 16;
+                case 3: wr(z, fetch16(z), z->a); return 13;
+                case 4: z->a = rd(z, bc(z)); return 7;
+                case 5: z->a = rd(z, de(z)); return 7;
+                case 6: set_xhl(z, idx, rd16(z, fetch16(z))); return 16;
+                default: z->a = rd(z, fetch16(z)); return 13;
+            }
+        case 3:
+            set_rp(z, p, idx, get_rp(z, p, idx) + (q ? -1 : 1));
+            return 6;
+        case 4:
+        case 5:
+            if (y == 6) {
+                uint16_t addr = MEM_ADDR();
+                uint8_t v = rd(z, addr);
+                wr(z, addr, zz == 4 ? inc8(z, v) : dec8(z, v));
+                return 11 + MEM_EXTRA;
+            }
+            set_r(z, y, idx, zz == 4 ? inc8(z, get_r(z, y, idx)) : dec8(z, get_r(z, y, idx)));
+            return 4;
+        case 6:
+            if (y == 6) {
+                uint16_t addr = MEM_ADDR();
+                wr(z, addr, fetch(z));
+                return 10 + (idx ? 5 : 0);
+            }
+            set_r(z, y, idx, fetch(z));
+            return 7;
+        default:
+            switch (y) {
+                case 0: z->a = z->a << 1 | z->a >> 7; z->f = (z->f & (S|Z|PV)) | (z->a & (X|Y|C)); break;
+                case 1: z->f = (z->f & (S|Z|PV)) | (z->a & C); z->a = z->a >> 1 | z->a << 7; z->f |= z->a & (X|Y); break;
+                case 2: {
+                    uint8_t carry = z->a >> 7;
+                    z->a = z->a << 1 | (z->f & C);
+                    z->f = (z->f & (S|Z|PV)) | (z->a & (X|Y)) | carry;
+                    break;
+                }
+                case 3: {
+                    uint8_t carry = z->a & 1;
+                    z->a = z->a >> 1 | (z->f & C) << 7;
+                    z->f = (z->f & (S|Z|PV)) | (z->a & (X|Y)) | carry;
+                    break;
+                }
+                case 4: daa(z); break;
+                case 5: z->a = ~z->a; z->f = (z->f & (S|Z|PV|C)) | H | N | (z->a & (X|Y)); break;
+                case 6: z->f = (z->f & (S|Z|PV)) | C | (z->a & (X|Y)); break;
+                default: z->f = (z->f & (S|Z|PV)) | ((z->f & C) ? H : C) | (z->a & (X|Y)); break;
+            }
+            return 4;
+        }
+    case 1:
+        if (op == 0x76) {
+            z->halted = true;
+            z->pc--;
+            return 4;
+        }
+        if (y == 6) {
+            // LD (HL),r uses the real H and L even when prefixed
+            uint16_t addr = MEM_ADDR();
+            wr(z, addr, get_r(z, zz, 0));
+            return 7 + MEM_EXTRA;
+        }
+        if (zz == 6) {
+            uint16_t addr = MEM_ADDR();
+            set_r(z, y, 0, rd(z, addr));
+            return 7 + MEM_EXTRA;
+        }
+        set_r(z, y, idx, get_r(z, zz, idx));
+        return 4;
+    case 2:
+        if (zz == 6) {
+            alu(z, y, rd(z, MEM_ADDR()));
+            return 7 + MEM_EXTRA;
+        }
+        alu(z, y, get_r(z, zz, idx));
+        return 4;
+    default:
+        switch (zz) {
+        case 0:
+            if (cond(z, y)) { z->pc = pop(z); return 11; }
+            return 5;
+        case 1:
+            if (!q) {
+                uint16_t v = pop(z);
+                if (p == 3) { z->a = v >> 8; z->f = v; } else set_rp(z, p, idx, v);
+                return 10;
+            }
+            switch (p) {
+                case 0: z->pc = pop(z); return 10;
+                case 1: {
+                    uint8_t t;
+                    t = z->b; z->b = z->b_; z->b_ = t;
+                    t = z->c; z->c = z->c_; z->c_ = t;
+                    t = z->d; z->d = z->d_; z->d_ = t;
+                    t = z->e; z->e = z->e_; z->e_ = t;
+                    t = z->h; z->h = z->h_; z->h_ = t;
+                    t = z->l; z->l = z->l_; z->l_ = t;
+                    return 4;
+                }
+                case 2: z->pc = get_xhl(z, idx); return 4;
+                default: z->sp = get_xhl(z, idx); return 6;
+            }
+        case 2: {
+            uint16_t nn = fetch16(z);
+            if (cond(z, y)) z->pc = nn;
+            return 10;
+        }
+        case 3:
+            switch (y) {
+                case 0: z->pc = fetch16(z); return 10;
+                case 1: return 0;   // CB, handled by the caller
+                case 2: {
+                    uint8_t n = fetch(z);
+                    z->out(z->ctx, z->a << 8 | n, z->a);
+                    return 11;
+                }
+                case 3: {
+                    uint8_t n = fetch(z);
+                    z->a = z->in(z->ctx, z->a << 8 | n);
+                    return 11;
+                }
+                case 4: {
+                    uint16_t v = rd16(z, z->sp);
+                    wr16(z, z->sp, get_xhl(z, idx));
+                    set_xhl(z, idx, v);
+                    return 19;
+                }
+                case 5: {
+                    // EX DE,HL is not changed by a prefix
+                    uint16_t v = de(z);
+                    set_de(z, hl(z));
+                    set_hl(z, v);
+                    return 4;
+                }
+                case 6: z->iff1 = z->iff2 = false; return 4;
+                default: z->iff1 = z->iff2 = true; return 4;
+            }
+        case 4: {
+            uint16_t nn = fetch16(z);
+            if (cond(z, y)) { push(z, z->pc); z->pc = nn; return 17; }
+            return 10;
+        }
+        case 5:
+            if (!q) {
+                push(z, p == 3 ? z->a << 8 | z->f : get_rp(z, p, idx));
+                return 11;
+            }
+            // p 0 is CALL nn, the prefixes are handled by the caller
+            {
+                uint16_t nn = fetch16(z);
+                push(z, z->pc);
+                z->pc = nn;
+                return 17;
+            }
+        case 6:
+            alu(z, y, fetch(z));
+            return 7;
+        default:
+            push(z, z->pc);
+            z->pc = y * 8;
+            return 11;
+        }
+    }
+#undef MEM_ADDR
+#undef MEM_EXTRA
+}
+
+void z80_reset(z80_t *z) {
+    if (!tables_done) make_tables();
+    z->pc = 0;
+    z->sp = 0xffff;
+    z->a = z->f = 0xff;
+    z->i = z->r = 0;
+    z->iff1 = z->iff2 = false;
+    z->im = 0;
+    z->halted = false;
+    z->tstates = 0;
+}
+
+int z80_step(z80_t *z) {
+    int t = 0;
+    int idx = 0;
+    if (z->halted) {
+        refresh(z);
+        z->tstates += 4;
+        return 4;
+    }
+    uint8_t op = fetch(z);
+    refresh(z);
+    while (op == 0xdd || op == 0xfd) {
+        idx = op == 0xdd ? 1 : 2;
+        t += 4;
+        op = fetch(z);
+        refresh(z);
+    }
+    if (op == 0xcb) {
+        t += cb(z, idx);
+    } else if (op == 0xed) {
+        t += ed(z); // a prefix before ED is ignored, as a NOP
+    } else {
+        t += step(z, op, idx);
+    }
+    z->tstates += t;
+    return t;
+}
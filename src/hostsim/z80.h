@@ -0,0 +1,45 @@
+#ifndef _Z80_H_
+#define _Z80_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Small Z80 interpreter for hostsim. All documented instructions with their T-states, plus the
+// IXH/IXL/IYH/IYL forms. No interrupts and no memory contention: the CPC's stretching of
+// instructions to whole microseconds is left to the caller.
+typedef struct z80 {
+    uint8_t a, f, b, c, d, e, h, l;
+    uint8_t a_, f_, b_, c_, d_, e_, h_, l_;
+    uint16_t ix, iy, sp, pc;
+    uint8_t i, r;
+    bool iff1, iff2;
+    uint8_t im;
+    bool halted;
+    uint64_t tstates;
+    void *ctx;
+    uint8_t (*read)(void *ctx, uint16_t addr);
+    void (*write)(void *ctx, uint16_t addr, uint8_t value);
+    uint8_t (*in)(void *ctx, uint16_t port);
+    void (*out)(void *ctx, uint16_t port, uint8_t value);
+} z80_t;
+
+// flags
+#define Z80_C   0x01
+#define Z80_N   0x02
+#define Z80_PV  0x04
+#define Z80_X   0x08
+#define Z80_H   0x10
+#define Z80_Y   0x20
+#define Z80_Z   0x40
+#define Z80_S   0x80
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void z80_reset(z80_t *z);
+// run one instruction, returns its T-states
+int z80_step(z80_t *z);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,74 @@
+// Bus latency measurement
+// A spare PIO state machine times each ROMEN falling edge to the moment the bus loop enables
+// the data bus outputs. Results are drained from its FIFO by core 0 while it waits for latch
+// bytes, and binned here.
+#include <string.h>
+#include <ff.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "latency.pio.h"
+#include "latency.h"
+
+static PIO lat_pio;
+static uint lat_sm;
+static latency_stats_t stats;
+
+void latency_init(PIO pio, uint sm, uint marker_pin) {
+    lat_pio = pio;
+    lat_sm = sm;
+    latency_reset();
+    // the bus loop drives the marker high by switching it to output along with the data bus
+    gpio_init(marker_pin);
+    gpio_put(marker_pin, 1);
+    gpio_set_dir(marker_pin, GPIO_IN);
+    gpio_pull_down(marker_pin);
+    uint offset = pio_add_program(pio, &latency_program);
+    latency_program_init(pio, sm, offset, marker_pin, LATENCY_LIMIT);
+}
+
+void __not_in_flash_func(latency_poll)(void) {
+    while (!pio_sm_is_rx_fifo_empty(lat_pio, lat_sm)) {
+        uint32_t x = pio_sm_get(lat_pio, lat_sm);
+        if (x == 0xffffffff) {
+            stats.missed++;
+            continue;
+        }
+        uint32_t loops = LATENCY_LIMIT - x;
+        stats.bins[loops < LATENCY_BINS ? loops : LATENCY_BINS - 1]++;
+        if (loops > stats.worst) stats.worst = loops;
+        stats.count++;
+    }
+}
+
+void latency_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+const latency_stats_t *latency_stats(void) {
+    return &stats;
+}
+
+// system clocks from ROMEN low (as seen by the input synchronisers) to data driven
+uint32_t latency_clocks(uint32_t loops) {
+    return 2 * loops + 1;
+}
+
+uint32_t latency_ns(uint32_t loops) {
+    return (uint32_t)((uint64_t)latency_clocks(loops) * 1000000000 / clock_get_hz(clk_sys));
+}
+
+bool latency_write_file(const char *loop) {
+    FIL fp;
+    if (f_open(&fp, LATENCY_FILE, FA_CREATE_ALWAYS|FA_WRITE) != FR_OK) return false;
+    f_printf(&fp, "# %s bus loop, clk_sys %u kHz, %u accesses, %u not driven, worst %u clocks %u ns, budget %u ns\n",
+        loop, clock_get_hz(clk_sys) / 1000, stats.count, stats.missed,
+        latency_clocks(stats.worst), latency_ns(stats.worst), LATENCY_BUDGET_NS);
+    f_printf(&fp, "clocks,ns,count\n");
+    for (int i=0;i<LATENCY_BINS;i++) {
+        if (stats.bins[i]) {
+            f_printf(&fp, "%s%u,%u,%u\n", i == LATENCY_BINS - 1 ? ">=" : "",
+                latency_clocks(i), latency_ns(i), stats.bins[i]);
+        }
+    }
+    return f_close(&fp) == FR_OK;
+}
@@ -0,0 +1,38 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/pio.h"
+
+// ROMEN to data bus driven latency histogram, built with LATENCY_MEASURE
+#define LATENCY_FILE        "LATENCY.CSV"
+#define LATENCY_LIMIT       255     // PIO loops before giving up on an access
+#define LATENCY_BINS        64      // one bin per PIO loop (2 system clocks), last bin is overflow
+#ifndef LATENCY_BUDGET_NS
+// approximate time the CPC allows from ~ROMEN to data being sampled in an M1 cycle, less set up time
+#define LATENCY_BUDGET_NS   300
+#endif
+
+typedef struct {
+    uint32_t bins[LATENCY_BINS];
+    uint32_t count;         // accesses measured
+    uint32_t missed;        // ROMEN cycles where the data bus was not driven
+    uint32_t worst;         // PIO loops
+} latency_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void latency_init(PIO pio, uint sm, uint marker_pin);
+void latency_poll(void);
+void latency_reset(void);
+const latency_stats_t *latency_stats(void);
+uint32_t latency_clocks(uint32_t loops);
+uint32_t latency_ns(uint32_t loops);
+// loop names the bus loop the histogram is for
+bool latency_write_file(const char *loop);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,281 @@
+// Live ROM banks over USB
+// In CPC mode the USB drive is a small virtual FAT12 volume instead of the flash drive. Its LIVE
+// directory has one file per ROM bank whose data sectors are the ROM RAM itself, so copying a ROM
+// onto LIVE/BANKnn.ROM replaces the bank at USB speed without going near SPIFTL or the flash.
+//
+// Nothing is stored for the boot sector, FAT or directories, they are generated on each read.
+// Every file is one 16K cluster and the volume has no free clusters, so when the host rewrites a
+// file the only cluster it can allocate is the one it has just freed and the data lands back in
+// the same bank. Host writes to the FAT and root are dropped; writes to the LIVE directory are
+// only read for the new file lengths and deletions, which are shown from then on. A deleted
+// file's cluster is free, so the next file copied to the drive lands in that bank.
+//
+// The root also has the read only STATS.TXT, BANKS.TXT and FTL.TXT from stats.c, one cluster
+// each after the ROM files. Their text is taken when the host reads the root directory, so the
+// sizes in the directory always match the data.
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pico/stdlib.h>
+#include "picorom.h"
+#include "live.h"
+#include "stats.h"
+
+#define LIVE_SECTOR         512
+#define LIVE_CLUSTER        (ROM_SIZE / LIVE_SECTOR)    // sectors per cluster
+#define LIVE_FAT_START      1
+#define LIVE_FAT_SECTORS    1
+#define LIVE_NUM_FATS       2
+#define LIVE_ROOT_START     (LIVE_FAT_START + LIVE_NUM_FATS * LIVE_FAT_SECTORS)
+#define LIVE_ROOT_ENTRIES   (LIVE_SECTOR / 32)
+#define LIVE_DIR_ENTRIES    (LIVE_SECTOR / 32)  // per sector of the LIVE directory
+#define LIVE_DATA_START     (LIVE_ROOT_START + 1)
+#define LIVE_DIR_CLUSTER    2   // the LIVE directory, then one cluster per file
+#define LIVE_DATE           (((2024 - 1980) << 9) | (1 << 5) | 1)
+#define LIVE_INFO_SIZE      3072    // text of all the stats files
+
+static uint8_t *lower_rom;
+static uint8_t *upper_roms;
+static int num_banks;
+static void (*hold_cpc)(void);
+static uint32_t dirty;          // files written since live_take
+static uint32_t last_write_ms;
+static int32_t lengths[LIVE_MAX_BANKS + 1];
+static char info[LIVE_INFO_SIZE];
+static uint16_t info_start[STATS_NUM_FILES];
+static uint16_t info_length[STATS_NUM_FILES];
+
+// ., .. and the files, in the directory's one cluster
+static_assert(2 + LIVE_MAX_BANKS + 1 <= LIVE_CLUSTER * LIVE_DIR_ENTRIES, "LIVE directory too big");
+
+void live_init(uint8_t *lower, uint8_t *upper, int banks, void (*hold)(void)) {
+    lower_rom = lower;
+    upper_roms = upper;
+    num_banks = banks;
+    hold_cpc = hold;
+    dirty = 0;
+    for (int i=0;i<=num_banks;i++) {
+        lengths[i] = LIVE_LENGTH_UNKNOWN;
+    }
+}
+
+static int num_files(void) {
+    return num_banks + 1;
+}
+
+// length in the directory we present
+static int32_t shown_length(int file) {
+    return lengths[file] == LIVE_LENGTH_UNKNOWN ? ROM_SIZE : lengths[file];
+}
+
+static int info_cluster(int file) {
+    return LIVE_DIR_CLUSTER + 1 + num_files() + file;
+}
+
+uint32_t live_lba_count(void) {
+    return LIVE_DATA_START + (1 + num_files() + STATS_NUM_FILES) * LIVE_CLUSTER;
+}
+
+static uint8_t *file_data(int file) {
+    return file == num_banks ? lower_rom : upper_roms + file * ROM_SIZE;
+}
+
+// 8.3 name as stored in a directory entry
+static void file_name(int file, char name[11]) {
+    char tmp[12];
+    if (file == num_banks) {
+        memcpy(name, "LOWER   ROM", 11);
+    } else {
+        sprintf(tmp, "BANK%02d  ROM", file);
+        memcpy(name, tmp, 11);
+    }
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void dir_entry(uint8_t *p, const char *name, uint8_t attr, uint16_t cluster, uint32_t size) {
+    memcpy(p, name, 11);
+    p[11] = attr;
+    put16(p + 22, 0);               // time
+    put16(p + 24, LIVE_DATE);
+    put16(p + 16, LIVE_DATE);       // created
+    put16(p + 18, LIVE_DATE);       // accessed
+    put16(p + 26, cluster);
+    put32(p + 28, size);
+}
+
+static void boot_sector(uint8_t *p) {
+    static const uint8_t jump[3] = { 0xeb, 0x3c, 0x90 };
+    memcpy(p, jump, 3);
+    memcpy(p + 3, "PICOROM ", 8);
+    put16(p + 11, LIVE_SECTOR);
+    p[13] = LIVE_CLUSTER;
+    put16(p + 14, LIVE_FAT_START);  // reserved sectors
+    p[16] = LIVE_NUM_FATS;
+    put16(p + 17, LIVE_ROOT_ENTRIES);
+    put16(p + 19, live_lba_count());
+    p[21] = 0xf8;                   // media
+    put16(p + 22, LIVE_FAT_SECTORS);
+    put16(p + 24, 1);               // sectors per track
+    put16(p + 26, 1);               // heads
+    p[36] = 0x80;                   // drive number
+    p[38] = 0x29;                   // extended boot signature
+    put32(p + 39, 0x50524f4d);      // serial
+    memcpy(p + 43, "PICOLIVE   ", 11);
+    memcpy(p + 54, "FAT12   ", 8);
+    p[510] = 0x55;
+    p[511] = 0xaa;
+}
+
+static void fat12_set(uint8_t *fat, int n, uint16_t v) {
+    uint8_t *p = fat + n * 3 / 2;
+    if (n & 1) {
+        p[0] = (p[0] & 0x0f) | (v << 4);
+        p[1] = v >> 4;
+    } else {
+        p[0] = v;
+        p[1] = (p[1] & 0xf0) | ((v >> 8) & 0x0f);
+    }
+}
+
+// every cluster but those of deleted files is in use, and each file is a single cluster
+static void fat_sector(uint8_t *p) {
+    fat12_set(p, 0, 0xff8);
+    fat12_set(p, 1, 0xfff);
+    fat12_set(p, LIVE_DIR_CLUSTER, 0xfff);
+    for (int i=0;i<num_files();i++) {
+        fat12_set(p, LIVE_DIR_CLUSTER + 1 + i, lengths[i] == LIVE_DELETED ? 0 : 0xfff);
+    }
+    for (int i=0;i<STATS_NUM_FILES;i++) {
+        fat12_set(p, info_cluster(i), 0xfff);
+    }
+}
+
+static void snapshot_info(void) {
+    int used = 0;
+    for (int i=0;i<STATS_NUM_FILES;i++) {
+        info_start[i] = used;
+        info_length[i] = used < LIVE_INFO_SIZE ? stats_format(i, info + used, LIVE_INFO_SIZE - used) : 0;
+        used += info_length[i];
+    }
+}
+
+static void root_sector(uint8_t *p) {
+    dir_entry(p, "PICOLIVE   ", 0x08, 0, 0);
+    dir_entry(p + 32, "LIVE       ", 0x10, LIVE_DIR_CLUSTER, 0);
+    snapshot_info();
+    for (int i=0;i<STATS_NUM_FILES;i++) {
+        dir_entry(p + 64 + i * 32, stats_dir_name(i), 0x21, info_cluster(i), info_length[i]);
+    }
+}
+
+// sector of the LIVE directory: ., .. then one entry per file, LIVE_DIR_ENTRIES to a sector
+static void dir_sector(uint8_t *p, int sector) {
+    char name[11];
+    for (int s=0;s<LIVE_DIR_ENTRIES;s++) {
+        int i = sector * LIVE_DIR_ENTRIES + s - 2;
+        if (i == -2) {
+            dir_entry(p + s * 32, ".          ", 0x10, LIVE_DIR_CLUSTER, 0);
+        } else if (i == -1) {
+            dir_entry(p + s * 32, "..         ", 0x10, 0, 0);
+        } else if (i < num_files()) {
+            file_name(i, name);
+            if (lengths[i] == LIVE_DELETED) {
+                name[0] = 0xe5;
+                dir_entry(p + s * 32, name, 0x20, 0, 0);
+            } else {
+                dir_entry(p + s * 32, name, 0x20, LIVE_DIR_CLUSTER + 1 + i, shown_length(i));
+            }
+        }
+    }
+}
+
+void live_read(uint32_t lba, uint8_t *buffer) {
+    memset(buffer, 0, LIVE_SECTOR);
+    if (lba == 0) {
+        boot_sector(buffer);
+    } else if (lba < LIVE_ROOT_START) {
+        if ((lba - LIVE_FAT_START) % LIVE_FAT_SECTORS == 0) fat_sector(buffer);
+    } else if (lba == LIVE_ROOT_START) {
+        root_sector(buffer);
+    } else if (lba >= LIVE_DATA_START && lba < LIVE_DATA_START + LIVE_CLUSTER) {
+        dir_sector(buffer, lba - LIVE_DATA_START);
+    } else if (lba >= LIVE_DATA_START + LIVE_CLUSTER && lba < live_lba_count()) {
+        uint32_t offset = (lba - LIVE_DATA_START - LIVE_CLUSTER) * LIVE_SECTOR;
+        int file = offset / ROM_SIZE;
+        offset %= ROM_SIZE;
+        if (file < num_files()) {
+            memcpy(buffer, file_data(file) + offset, LIVE_SECTOR);
+        } else if (offset < info_length[file - num_files()]) {
+            file -= num_files();
+            memcpy(buffer, info + info_start[file] + offset, MIN(LIVE_SECTOR, info_length[file] - offset));
+        }
+    }
+}
+
+// pick up lengths and deletions from a sector of the host's copy of the LIVE directory. The host
+// may move entries between sectors, so a file not in this one is left as it is
+static void parse_dir(const uint8_t *p) {
+    char name[11];
+    for (int i=0;i<num_files();i++) {
+        int32_t length = LIVE_LENGTH_UNKNOWN;
+        file_name(i, name);
+        for (int e=0;e<LIVE_DIR_ENTRIES;e++) {
+            const uint8_t *entry = p + e * 32;
+            if (entry[11] == 0x0f || memcmp(entry + 1, name + 1, 10) != 0) continue; // LFN
+            if (entry[0] == (uint8_t)name[0]) {
+                length = entry[28] | (entry[29] << 8) | (entry[30] << 16) | ((uint32_t)entry[31] << 24);
+                break;
+            }
+            if (entry[0] == 0xe5) length = LIVE_DELETED;
+        }
+        if (length != LIVE_LENGTH_UNKNOWN && length != shown_length(i)) {
+            lengths[i] = length;
+            dirty |= 1 << i;
+        }
+    }
+}
+
+void live_write(uint32_t lba, const uint8_t *buffer) {
+    if (lba >= LIVE_DATA_START && lba < LIVE_DATA_START + LIVE_CLUSTER) {
+        parse_dir(buffer);
+    } else if (lba >= LIVE_DATA_START + LIVE_CLUSTER && lba < live_lba_count() - STATS_NUM_FILES * LIVE_CLUSTER) {
+        uint32_t offset = (lba - LIVE_DATA_START - LIVE_CLUSTER) * LIVE_SECTOR;
+        int file = offset / ROM_SIZE;
+        hold_cpc();
+        memcpy(file_data(file) + offset % ROM_SIZE, buffer, LIVE_SECTOR);
+        // a new file in a deleted file's cluster, perhaps under another name
+        if (lengths[file] == LIVE_DELETED) lengths[file] = LIVE_LENGTH_UNKNOWN;
+        dirty |= 1 << file;
+    } else {
+        return;
+    }
+    last_write_ms = to_ms_since_boot(get_absolute_time());
+}
+
+// true while the host is writing files
+bool live_pending(void) {
+    return dirty != 0;
+}
+
+// Files the host has finished writing, once nothing has been written for quiet_ms.
+// Bit n is BANKn.ROM, bit banks is LOWER.ROM
+uint32_t live_take(uint32_t quiet_ms) {
+    uint32_t files = dirty;
+    if (!files || to_ms_since_boot(get_absolute_time()) - last_write_ms < quiet_ms) return 0;
+    dirty = 0;
+    return files;
+}
+
+// length of the file from the host's last directory write
+int32_t live_length(int file) {
+    return lengths[file];
+}
@@ -0,0 +1,30 @@
+#ifndef _LIVE_H_
+#define _LIVE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// lengths from the host's directory entries
+#define LIVE_LENGTH_UNKNOWN -1
+#define LIVE_DELETED        -2
+
+#define LIVE_MAX_BANKS      16  // as upper_roms is 16 bits
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// upper holds banks ROMs of ROM_SIZE. File banks is LOWER.ROM. hold is called before any host
+// data is copied into a bank, to stop the CPC running it; it is called for every data sector
+void live_init(uint8_t *lower, uint8_t *upper, int banks, void (*hold)(void));
+uint32_t live_lba_count(void);
+void live_read(uint32_t lba, uint8_t *buffer);
+void live_write(uint32_t lba, const uint8_t *buffer);
+bool live_pending(void);
+uint32_t live_take(uint32_t quiet_ms);
+int32_t live_length(int file);
+// switch the USB drive between the live volume and the flash drive
+void msc_set_live(bool on);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,142 @@
+// RAM ring buffer logger
+// debug() and fdebug() only store a timestamp, the format pointer and the raw arguments
+// (with copies of any strings) in a ring. There is one ring per core, so each ring has a
+// single producer and needs no locks. Formatting and the FatFs append happen in log_flush(),
+// which is only called when the CPC is held in reset or waiting for a command to complete.
+// Format strings must be literals, and only %s and 32 bit integer conversions are supported.
+// Do not log from interrupt handlers.
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ff.h>
+#include "pico/stdlib.h"
+#include "pico/sync.h"
+#include "picorom.h"
+#include "log.h"
+
+#undef DEBUG_TO_FILE
+
+typedef struct {
+    uint32_t time_us;
+    const char *fmt;
+    uint32_t args[LOG_MAX_ARGS];        // integer value, or offset into strings for %s
+    char strings[LOG_STRING_SPACE];
+} log_record_t;
+
+typedef struct {
+    volatile uint32_t head;             // only written by the owning core
+    volatile uint32_t tail;             // only written by log_flush()
+    volatile uint32_t dropped;
+    log_record_t records[LOG_RING_SIZE];
+} log_ring_t;
+
+#ifdef DEBUG_TO_FILE
+static log_ring_t rings[NUM_CORES];
+
+// skip to the conversion character of the % spec at p
+static const char *conversion(const char *p) {
+    while (*p && strchr("-+ #0123456789.lhz", *p)) p++;
+    return p;
+}
+
+static void __not_in_flash_func(log_vwrite)(const char *fmt, va_list args) {
+    log_ring_t *ring = &rings[get_core_num()];
+    uint32_t head = ring->head;
+    if (head - ring->tail >= LOG_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    log_record_t *r = &ring->records[head & (LOG_RING_SIZE - 1)];
+    uint32_t used = 0;
+    int n = 0;
+    r->time_us = time_us_32();
+    r->fmt = fmt;
+    r->strings[LOG_STRING_SPACE - 1] = 0;
+    for (const char *p = fmt; *p && n < LOG_MAX_ARGS; p++) {
+        if (*p != '%') continue;
+        if (*++p == '%') continue;
+        p = conversion(p);
+        if (*p == 's') {
+            const char *s = va_arg(args, const char *);
+            uint32_t l = strnlen(s, LOG_STRING_SPACE - 1 - used);
+            if (l == 0) {
+                r->args[n] = LOG_STRING_SPACE - 1; // empty string, or out of space
+            } else {
+                memcpy(&r->strings[used], s, l);
+                r->strings[used + l] = 0;
+                r->args[n] = used;
+                used += l + 1;
+            }
+        } else {
+            r->args[n] = va_arg(args, uint32_t);
+        }
+        n++;
+    }
+    __dmb();
+    ring->head = head + 1;
+}
+#endif
+
+void debug(const char *msg) {
+#ifdef DEBUG_TO_FILE
+    fdebug("%s", msg);
+#endif
+}
+
+void fdebug(const char *fmt, ...) {
+#ifdef DEBUG_TO_FILE
+    va_list args;
+    va_start(args, fmt);
+    log_vwrite(fmt, args);
+    va_end(args);
+#endif
+}
+
+// Format everything in the rings and append it to LOG_FILE, oldest first.
+// Must be called from core 0 with the drive mounted. Returns the number of records written.
+uint32_t log_flush(void) {
+    uint32_t count = 0;
+#ifdef DEBUG_TO_FILE
+    FIL fp;
+    char line[256];
+    uintptr_t a[LOG_MAX_ARGS];
+
+    if (f_open(&fp, LOG_FILE, FA_WRITE|FA_OPEN_APPEND) != FR_OK) return 0;
+    while (1) {
+        log_ring_t *ring = NULL;
+        // pick the older record of the two rings
+        for (int i=0;i<NUM_CORES;i++) {
+            if (rings[i].tail == rings[i].head) continue;
+            if (ring == NULL ||
+                (int32_t)(rings[i].records[rings[i].tail & (LOG_RING_SIZE - 1)].time_us -
+                          ring->records[ring->tail & (LOG_RING_SIZE - 1)].time_us) < 0) {
+                ring = &rings[i];
+            }
+        }
+        if (ring == NULL) break;
+        __dmb();
+        log_record_t *r = &ring->records[ring->tail & (LOG_RING_SIZE - 1)];
+        int n = 0;
+        for (const char *p = r->fmt; *p && n < LOG_MAX_ARGS; p++) {
+            if (*p != '%') continue;
+            if (*++p == '%') continue;
+            p = conversion(p);
+            a[n] = (*p == 's') ? (uintptr_t)&r->strings[r->args[n]] : r->args[n];
+            n++;
+        }
+        snprintf(line, sizeof(line), r->fmt, a[0], a[1], a[2], a[3]);
+        f_printf(&fp, "%06u.%03u %d: %s\n", r->time_us / 1000, r->time_us % 1000, ring - rings, line);
+        __dmb();
+        ring->tail++;
+        count++;
+    }
+    for (int i=0;i<NUM_CORES;i++) {
+        if (rings[i].dropped) {
+            f_printf(&fp, "core %d: %u messages dropped\n", i, rings[i].dropped);
+            rings[i].dropped = 0;
+        }
+    }
+    f_close(&fp);
+#endif
+    return count;
+}
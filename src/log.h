@@ -0,0 +1,23 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// RAM ring buffer behind debug()/fdebug(). Records are formatted and appended to
+// LOG_FILE only when log_flush() is called.
+#define LOG_FILE            "DEBUG.TXT"
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE       32      // records per core, must be a power of 2
+#endif
+#define LOG_MAX_ARGS        4
+#define LOG_STRING_SPACE    40      // bytes per record for copies of %s arguments
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint32_t log_flush(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
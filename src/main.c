@@ -4,9 +4,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
 #include <tusb.h>
 #include <bsp/board.h>
 #include <ff.h>
+#include <diskio.h>
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
 #include "pico/bootrom.h"
@@ -17,34 +19,52 @@
 #include "hardware/regs/xip.h"
 #include "hardware/flash.h"
 #include "hardware/dma.h"
+#include "hardware/structs/bus_ctrl.h"
+#include "hardware/interp.h"
 #include "latch.pio.h"
 #include "bootsel_button.h"
 #include "flash.h"
+#include "picorom.h"
+#include "romindex.h"
+#include "dircache.h"
+#include "log.h"
+#include "protocol.h"
+#include "romcrc.h"
+#include "live.h"
+#include "usbcmd.h"
+#include "bulk.h"
+#include "stats.h"
+#include "drivemap.h"
+#include "boottime.h"
 
 #undef DEBUG_TO_SERIAL
-#undef DEBUG_TO_FILE
-#define VER_MAJOR 3
-#define VER_MINOR 1
-#define VER_PATCH 1
 #ifndef CLOCK_SPEED_KHZ
 // overclock speed - pick the lowest freq that works reliably
+// or run |PCAL with the latency firmware, which saves the best speed for this board in CLOCK_FILE
 //#define CLOCK_SPEED_KHZ 200000
 //#define CLOCK_SPEED_KHZ 225000
 #define CLOCK_SPEED_KHZ 250000
 //#define CLOCK_SPEED_KHZ 260000
 #endif
 
-// not enough RAM for 16
+#define CLOCK_FILE "CLOCK.CFG"
+
+// 17 x 16K does not fit in 256K, see "RAM budget" in the readme.
+// ROM_RAM in memmap_custom.ld must hold NUM_ROM_BANKS + 1 ROMs
+#ifndef NUM_ROM_BANKS
 #define NUM_ROM_BANKS 12
-#define ROM_SIZE 16384
+#endif
+// each bank is a file on the live drive, see live.c
+static_assert(NUM_ROM_BANKS <= LIVE_MAX_BANKS, "more banks than the live drive can show");
 // RAM copies of the ROMs
-#undef USE_XIP_CACHE_AS_RAM
 #ifdef USE_XIP_CACHE_AS_RAM
-static uint8_t *LOWER_ROM = (uint8_t *)0x15000000;
+// copy_to_ram build, the lower ROM uses the 16K XIP cache SRAM
+static uint8_t *LOWER_ROM = (uint8_t *)XIP_SRAM_BASE;
 #else
-static uint8_t  LOWER_ROM[ROM_SIZE];
+static uint8_t  LOWER_ROM[ROM_SIZE] __attribute__((section(".rom_ram.lower")));
 #endif
-static uint8_t UPPER_ROMS[NUM_ROM_BANKS][ROM_SIZE];
+// in their own SRAM banks, see memmap_custom.ld
+static uint8_t UPPER_ROMS[NUM_ROM_BANKS][ROM_SIZE] __attribute__((section(".rom_ram.upper")));
 #define NO_ROM 0xff
 static volatile uint8_t rom_bank = 0; // index into upper ROMS, 0xff = no ROM
 static volatile  uint16_t upper_roms = 0; // bitmask to indicate which ROM banks are active
@@ -54,8 +74,7 @@ static FATFS filesystem;
 // values from the linker
 extern uint32_t __FLASH_START[];
 extern uint32_t __FLASH_LEN[];
-extern uint32_t __DRIVE_START[];
-extern uint32_t __DRIVE_LEN[];
+extern char __flash_binary_end[];   // the flash drive follows, see drivemap.c
 
 
 const uint32_t ADDRESS_BUS_MASK = 0x3fff;
@@ -73,6 +92,8 @@ const uint32_t FULL_MASK = ADDRESS_BUS_MASK|DATA_BUS_MASK|ROMEN_MASK|A15_MASK|WR
 #define CPC_ASSERT_RESET()   do { debug("CPC_ASSERT_RESET"); gpio_set_dir(RESET_GPIO, GPIO_OUT); } while(0)
 #define CPC_RELEASE_RESET()  do { debug("CPC_RELEASE_RESET"); gpio_set_dir(RESET_GPIO, GPIO_IN); } while(0)
 
+#define FATAL_SECTOR_SIZE   6   // the drive was formatted by a firmware with the other sector size
+
 void fatal(int flashes) {
     while(1) {
         for (int i=0;i<flashes;i++) {
@@ -85,20 +106,24 @@ void fatal(int flashes) {
     }
 }
 
+// staging buffer for PSAVE. Frames are collected here and written to FatFs a cluster at a time.
+// Also the f_mkfs work area, so it does not need 4K of stack
+static uint8_t psave_buf[FF_MAX_SS];
+
 void format() {
     FRESULT res;        /* API result code */
     FIL fp;
-    BYTE work[FF_MAX_SS]; /* Work area (larger is better for processing time) */
     MKFS_PARM params = {
         FM_FAT,
         1,
         0,
         0,
-        0
+        DRIVE_CLUSTER_SIZE
     };
-    res = f_mkfs("", &params, work, sizeof(work));
+    res = f_mkfs("", &params, psave_buf, sizeof(psave_buf));
     if (res) fatal(res);
     f_mount(&filesystem, "", 1);
+    disk_data_start = filesystem.database;
     f_setlabel("PICOROM");
     f_open(&fp, "README.TXT", FA_CREATE_ALWAYS|FA_WRITE);
     f_printf(&fp, "Welcome to PICOROM %d.%d.%d\n", VER_MAJOR, VER_MINOR, VER_PATCH );
@@ -145,10 +170,22 @@ void led_task() {
     }
 }
 
-void usb_mode() {
+void __attribute__((noreturn)) usb_mode() {
     board_init();
+    if (tud_inited()) {
+        // coming from CPC mode, make the host see the flash drive instead of the live volume
+        tud_disconnect();
+        msc_set_live(false);
+        sleep_ms(100);
+        tud_connect();
+    }
+    msc_set_live(false);
+    // the FTL is only started once something needs the drive
+    flash_init();
     tud_init(BOARD_TUD_RHPORT);
     stdio_init_all();  
+    boot_finish("USB ready");
+    log_flush();
     f_unmount("");
     while(1) // the mainloop
     {
@@ -158,62 +195,81 @@ void usb_mode() {
     } 
 }
 
-void debug(const char *msg) {
-#ifdef DEBUG_TO_FILE
-    FIL fp;
-    UINT l;
-    f_open(&fp, "DEBUG.TXT", FA_WRITE|FA_OPEN_APPEND);
-    f_printf(&fp, "%06d: %s\n", to_ms_since_boot(get_absolute_time()), msg);
-    f_close(&fp);
-#endif
-}
+// ROM image checks, entry CHECK_LOWER is the lower ROM
+#define CHECK_LOWER     NUM_ROM_BANKS
+#define CRC_UNCHECKED   0   // nothing to compare with
+#define CRC_OK          1   // matches the ROM index, the config file or a bulk upload
+#define CRC_MISMATCH    2
+#define SCRUB_INTERVAL_MS 1000  // one bank is scrubbed per interval
+#define ROM_SOURCE_LEN  32
+typedef struct {
+    uint32_t crc;           // CRC32 of the image as loaded, as in the ROM index
+    uint32_t scrub_crc;     // CRC32 of the part the Pico never writes to
+    uint32_t load_us;       // time to read the image from the drive
+    uint16_t meta_reads;    // FatFs reads of the boot sector, FATs and root directory for it
+    uint16_t length;
+    uint16_t scrub_length;
+    uint8_t status;
+    bool scrub_failed;      // the RAM copy changed after loading
+    char source[ROM_SOURCE_LEN];    // drive path, or how it was sent, for BANKS.TXT
+} rom_check_t;
+static rom_check_t rom_checks[NUM_ROM_BANKS+1];
 
-void fdebug(const char *fmt, ...) {
-#ifdef DEBUG_TO_FILE
-    FIL fp;
-    UINT l;
-    char buf[256];
-    va_list args;
-    va_start (args, fmt);
-    vsprintf (buf, fmt, args);
-    va_end (args);
-    f_open(&fp, "DEBUG.TXT", FA_WRITE|FA_OPEN_APPEND);
-    f_printf(&fp, "%06d: %s\n", to_ms_since_boot(get_absolute_time()), buf);
-    f_close(&fp);
-#endif
+// counters for STATS.TXT
+static uint32_t latch_selects;
+static uint32_t latch_commands;
+static uint32_t usb_commands;
+static uint32_t bulk_loads;
+static uint32_t live_loads;
+static uint32_t scrubs;
+static uint32_t scrub_failures;
+static uint32_t bus_loop_starts;
+static uint32_t clock_khz;
+static uint32_t boot_ms;        // when the CPC was first let out of reset
+
+// Clear the bank after a ROM image of length bytes and CRC it with the DMA sniffer
+static void check_rom(uint8_t *rom, uint32_t length, rom_check_t *check, const char *source) {
+    // don't leave the end of the previous image behind a short one
+    memset(rom + length, 0, ROM_SIZE - length);
+    check->length = length;
+    check->load_us = 0;
+    check->meta_reads = 0;
+    strncpy(check->source, source, ROM_SOURCE_LEN - 1);
+    check->source[ROM_SOURCE_LEN - 1] = 0;
+    // the response buffer is written by the Pico, so the scrub skips it in upper ROMs
+    check->scrub_length = (check == &rom_checks[CHECK_LOWER] || length < RESP_BUF) ? length : RESP_BUF;
+    check->crc = romcrc_compute(rom, length, check->scrub_length, &check->scrub_crc);
+    check->scrub_failed = false;
 }
 
+// Fast seek link map for the ROM being loaded, so f_read finds each cluster from the map
+// instead of the FAT. A 16K image in 512 byte clusters is one fragment when it was copied to
+// an empty area, files in more than LOAD_FRAGMENTS pieces are read through the FAT as before
+#define LOAD_FRAGMENTS  8
 
-#pragma pack(1)
-typedef struct {
-    uint8_t user_number;
-    char filename[8];
-    char ext[3];
-    char zeros[4];
-    uint8_t block_number;
-    uint8_t last_block;
-    uint8_t file_type;
-    uint16_t data_length;
-    uint16_t data_location;
-    uint8_t first_block;
-    uint16_t logical_length;
-    uint16_t entry_address;
-    char unused[36];
-    uint8_t real_length_h;
-    uint16_t real_length;
-    uint16_t checksum;
-    char unused2[59];
-} amsdos_header_t;
-#pragma pack()
-
-bool load_rom(const TCHAR* path, void* dest) {
+void remove_upper_rom(int bank);
+
+// Load a ROM image into dest and CRC it with the DMA sniffer. The CRC is compared with
+// expected_crc, or with the ROM index if that is 0. An upper bank is removed before it is
+// overwritten, and load_upper_rom() only adds it back once the whole image is in
+bool load_rom(const TCHAR* path, uint8_t *dest, rom_check_t *check, uint32_t expected_crc) {
     FIL fp;
     FRESULT fr;
     UINT bytes_read;
-    FILINFO fno;
+    DWORD clmt[2 + LOAD_FRAGMENTS * 2];
+    uint32_t meta_reads = disk_meta_reads;
+    uint64_t start_us = time_us_64();
     fdebug("Loading %s", path);
-    if (f_stat(path, &fno) != FR_OK) return false;
     if (f_open(&fp, path, FA_READ) != FR_OK) return false;
+    // the file's directory entry is still in the FatFs window, for the ROM index check
+    uint16_t ftime = fp.dir_ptr[22] | fp.dir_ptr[23] << 8;
+    uint16_t fdate = fp.dir_ptr[24] | fp.dir_ptr[25] << 8;
+    uint32_t fsize = f_size(&fp);
+    clmt[0] = sizeof(clmt) / sizeof(clmt[0]);
+    fp.cltbl = clmt;
+    if (f_lseek(&fp, CREATE_LINKMAP) != FR_OK) fp.cltbl = NULL;
+    romcrc_abort(); // the scrub may be reading this bank
+    if (check != &rom_checks[CHECK_LOWER]) remove_upper_rom(check - rom_checks);
     fr = f_read(&fp, dest, 128, &bytes_read);
     if (fr != FR_OK) {
         f_close(&fp);
@@ -221,14 +277,12 @@ bool load_rom(const TCHAR* path, void* dest) {
         return false;
     }
     amsdos_header_t *hdr = (amsdos_header_t *)dest;
-    uint16_t chksum = 0;
-    for (int i=0;i<67;i++) {
-        chksum += *(uint8_t *)(dest+i);
-    }
     UINT btr;
-    fdebug("Calculated chksum 0X%02X header chksum 0X%02X", chksum, hdr->checksum);
-    if (chksum == hdr->checksum) {
+    bool has_header = bytes_read == 128 && amsdos_header_valid(dest);
+    fdebug("AMSDOS header %s", has_header ? "found" : "not found");
+    if (has_header) {
         btr = hdr->logical_length;
+        if (btr > ROM_SIZE) btr = ROM_SIZE;
     } else {
         f_rewind(&fp);
         btr = ROM_SIZE;
@@ -236,34 +290,243 @@ bool load_rom(const TCHAR* path, void* dest) {
     fr = f_read(&fp, dest, btr, &bytes_read);
     fdebug("btr=%d bytes_read=%d fr=%d", btr, bytes_read, fr);
     f_close(&fp);
-    if (fr != FR_OK) return false;
+    if (fr != FR_OK || bytes_read == 0) return false;
+    check_rom(dest, bytes_read, check, path);
+    check->load_us = time_us_64() - start_us;
+    check->meta_reads = disk_meta_reads - meta_reads;
+    boot_mark("load", path);
+    if (expected_crc == 0) {
+        romindex_entry_t entry;
+        if (romindex_lookup(*path == '/' ? path + 1 : path, &entry) && entry.length == bytes_read &&
+            entry.size == fsize && entry.fdate == fdate && entry.ftime == ftime) {
+            expected_crc = entry.crc32;
+        }
+    }
+    check->status = expected_crc == 0 ? CRC_UNCHECKED : expected_crc == check->crc ? CRC_OK : CRC_MISMATCH;
+    fdebug("%s crc32 %08x expected %08x", path, check->crc, expected_crc);
     return true;
 }
 
-bool load_lower_rom(const TCHAR* path) {
-    return load_rom(path, (void *)LOWER_ROM);
+bool load_lower_rom(const TCHAR* path, uint32_t expected_crc) {
+    return load_rom(path, LOWER_ROM, &rom_checks[CHECK_LOWER], expected_crc);
+}
+
+// Put back a lower ROM that a failed upload has partly overwritten, from the file it was
+// loaded from, or else the OS ROM cpc_mode() falls back to. The CPC can't run without one.
+static void restore_lower_rom(void) {
+    char source[ROM_SOURCE_LEN];
+    strcpy(source, rom_checks[CHECK_LOWER].source);
+    if (load_lower_rom(source, 0)) return;
+    if (!load_lower_rom("OS_6128.ROM", 0)) fdebug("lower ROM %s can't be restored", source);
 }
 
 void remove_upper_rom(int bank) {
     upper_roms &= ~(1<<bank);
 }
 
-bool load_upper_rom(const TCHAR* path, int bank) {
+bool load_upper_rom(const TCHAR* path, int bank, uint32_t expected_crc) {
     if ((bank < 0) || (bank >= NUM_ROM_BANKS)) return false;
-    bool ret = load_rom(path, (void *)UPPER_ROMS[bank]);
+    bool ret = load_rom(path, UPPER_ROMS[bank], &rom_checks[bank], expected_crc);
     if (ret) {
         upper_roms |= (1<<bank);
     }
     return ret;
 }
 
+static bool bulk_crc_running;   // the sniffer is checking a bulk upload, see bulk_load_poll()
+
+// Called while core 0 waits for the latch. Every SCRUB_INTERVAL_MS the next loaded ROM is
+// CRC'd by the DMA sniffer in the background and compared with its CRC from loading.
+static void __not_in_flash_func(scrub_poll)(void) {
+    static absolute_time_t next_scrub;
+    static int bank = CHECK_LOWER;
+    uint32_t crc;
+    if (bulk_crc_running) return;
+    if (romcrc_done(&crc)) {
+        scrubs++;
+        if (crc != rom_checks[bank].scrub_crc && !rom_checks[bank].scrub_failed) {
+            scrub_failures++;
+            rom_checks[bank].scrub_failed = true;
+            fdebug("ROM %d changed in RAM, crc32 %08x", bank, crc);
+        }
+    }
+    if (romcrc_busy() || live_pending() || absolute_time_diff_us(next_scrub, get_absolute_time()) < 0) return;
+    next_scrub = make_timeout_time_ms(SCRUB_INTERVAL_MS);
+    for (int i=0;i<=NUM_ROM_BANKS;i++) {
+        bank = bank == CHECK_LOWER ? 0 : bank + 1;
+        bool loaded = bank == CHECK_LOWER || (upper_roms & (1<<bank));
+        if (loaded && rom_checks[bank].scrub_length) {
+            romcrc_start(bank == CHECK_LOWER ? LOWER_ROM : UPPER_ROMS[bank], rom_checks[bank].scrub_length);
+            return;
+        }
+    }
+}
+
+static void start_bus_loop(void);
+
+// Called while core 0 waits for the latch. Runs USB for the live ROM volume, see live.c.
+// The CPC is held in reset from the first write until the host has been quiet for
+// LIVE_QUIET_MS, then the written banks are taken over like a |ROMIN.
+#define LIVE_QUIET_MS 200
+static bool live_holding = false;
+
+// From live_write(), inside tud_task(): the CPC goes into reset before the sector is copied
+// into the bank, so it never runs a ROM the host is part way through
+static void live_hold(void) {
+    if (live_holding) return;
+    CPC_ASSERT_RESET();
+    romcrc_abort(); // the scrub may be reading a bank being written
+    live_holding = true;
+}
+
+static void live_poll(void) {
+    tud_task();
+    if (!live_holding) {
+        if (!live_pending()) return;
+        live_hold();
+    }
+    uint32_t files = live_take(LIVE_QUIET_MS);
+    if (!files) return;
+    for (int i=0;i<=NUM_ROM_BANKS;i++) {
+        if (!(files & (1<<i))) continue;
+        uint8_t *rom = i == CHECK_LOWER ? LOWER_ROM : UPPER_ROMS[i];
+        int32_t length = live_length(i);
+        if (i != CHECK_LOWER && (length == LIVE_DELETED || length == 0)) {
+            fdebug("LIVE bank %d removed", i);
+            remove_upper_rom(i);
+            continue;
+        }
+        // a file is one cluster, so a ROM with a header is at most ROM_SIZE - 128 bytes
+        if (length < 0 || length > ROM_SIZE) length = ROM_SIZE;
+        if (length >= 128 && amsdos_header_valid(rom)) {
+            uint32_t logical = ((amsdos_header_t *)rom)->logical_length;
+            length -= 128;
+            if (logical < (uint32_t)length) length = logical;
+            memmove(rom, rom + 128, length);
+        }
+        check_rom(rom, length, &rom_checks[i], "live drive");
+        live_loads++;
+        rom_checks[i].status = CRC_UNCHECKED;
+        if (i != CHECK_LOWER) upper_roms |= (1<<i);
+        fdebug("LIVE bank %d %d bytes crc32 %08x", i, length, rom_checks[i].crc);
+    }
+    start_bus_loop();
+    log_flush();
+    live_holding = false;
+    CPC_RELEASE_RESET();
+}
+
+// Called while core 0 waits for the latch. ROM images sent to the vendor bulk interface (see
+// bulk.c) are received into a bank with nothing loaded while the CPC runs, CRC checked in the
+// background, then copied over the target bank with the CPC held in reset, so it never runs half
+// a ROM. With no free bank the CPC is held in reset for the whole transfer and the image goes
+// straight in. A failed upload straight into the lower ROM puts the previous one back.
+static void bulk_load_poll(void) {
+    static bulk_load_t load;
+    static int shadow;          // bank receiving the image, -1 for straight into the target
+    static bool holding = false;
+    uint32_t crc = 0;
+    bool crc_ready = false;
+    int event;
+
+    if (bulk_crc_running) {
+        // a ROM load or the live drive may have taken the sniffer, start again
+        if (!romcrc_done(&crc)) {
+            if (!romcrc_busy()) romcrc_start(UPPER_ROMS[shadow], load.length);
+            return;
+        }
+        bulk_crc_running = false;
+        crc_ready = true;
+        event = BULK_DONE;
+    } else {
+        event = bulk_poll(&load);
+    }
+    if (event == BULK_IDLE) return;
+    bool lower = load.bank == NO_ROM;
+    if (!lower && load.bank >= NUM_ROM_BANKS) {
+        bulk_receive(NULL);
+        return;
+    }
+    uint8_t *rom = lower ? LOWER_ROM : UPPER_ROMS[load.bank];
+    if (event == BULK_START) {
+        shadow = -1;
+        for (int i=NUM_ROM_BANKS-1;i>=0;i--) {
+            if (i != load.bank && !(upper_roms & (1<<i))) {
+                shadow = i;
+                break;
+            }
+        }
+        if (shadow < 0) {
+            CPC_ASSERT_RESET();
+            romcrc_abort(); // the scrub may be reading this bank
+            holding = true;
+        }
+        bulk_receive(shadow < 0 ? rom : UPPER_ROMS[shadow]);
+        return;
+    }
+    // BULK_DONE
+    uint8_t status = load.status;
+    rom_check_t *check = &rom_checks[lower ? CHECK_LOWER : load.bank];
+    if (status == BULK_STATUS_OK && shadow >= 0) {
+        // something was loaded into the shadow bank over CDC or the live drive meanwhile
+        if (upper_roms & (1<<shadow)) {
+            status = BULK_STATUS_BUSY;
+        } else if (!crc_ready) {
+            romcrc_start(UPPER_ROMS[shadow], load.length);
+            bulk_crc_running = true;
+            return;
+        } else if (crc != load.crc) {
+            status = BULK_STATUS_CRC;
+        }
+    }
+    if (status == BULK_STATUS_OK) {
+        if (!holding) {
+            CPC_ASSERT_RESET();
+            holding = true;
+        }
+        romcrc_abort();
+        if (shadow >= 0) memcpy(rom, UPPER_ROMS[shadow], load.length);
+        check_rom(rom, load.length, check, "USB bulk");
+        bulk_loads++;
+        crc = check->crc;
+        check->status = crc == load.crc ? CRC_OK : CRC_MISMATCH;
+        if (check->status == CRC_MISMATCH) status = BULK_STATUS_CRC;
+        if (!lower) upper_roms |= (1<<load.bank);
+        fdebug("BULK bank %d %u bytes crc32 %08x", load.bank, load.length, crc);
+    } else if (holding) {
+        // part written straight into the bank
+        if (lower) {
+            restore_lower_rom();
+        } else {
+            remove_upper_rom(load.bank);
+        }
+    }
+    if (holding) {
+        start_bus_loop();
+        log_flush();
+        sleep_ms(10);
+        holding = false;
+        CPC_RELEASE_RESET();
+    }
+    bulk_reply(status, crc);
+}
+
+// short result of the checks for |ROMS
+static const char *rom_check_text(int bank) {
+    if (rom_checks[bank].scrub_failed) return " RAM!";
+    if (rom_checks[bank].status == CRC_MISMATCH) return " CRC!";
+    if (rom_checks[bank].status == CRC_OK) return " ok";
+    return "";
+}
+
 bool load_config(const TCHAR *filename) 
 {
     FIL fp;
     TCHAR buf[256];
     char *token;
-	const char delim[]=": 	";
+	const char delim[]=": 	\r\n";
  	int bank;
+    char *path, *crc;   // optional CRC32 in hex after the file name
 
     debug(filename);
     if (f_open(&fp, filename, FA_READ)) {
@@ -276,282 +539,1120 @@ bool load_config(const TCHAR *filename)
         if (token == NULL) {
             continue;
         } else if (*token == 'L') {
-            load_lower_rom(strtok(NULL, delim));
+            path = strtok(NULL, delim);
+            crc = strtok(NULL, delim);
+            load_lower_rom(path, crc ? strtoul(crc, NULL, 16) : 0);
         } else if (isdigit(*token)) {
             bank = atoi(token);
-            load_upper_rom(strtok(NULL, delim), bank);
+            path = strtok(NULL, delim);
+            crc = strtok(NULL, delim);
+            load_upper_rom(path, bank, crc ? strtoul(crc, NULL, 16) : 0);
         }
     }
     f_close(&fp);
     return true;
 }
 
+// clock speed saved by calibration, or CLOCK_SPEED_KHZ
+uint32_t load_clock_config(void) {
+    FIL fp;
+    char buf[16];
+    uint32_t khz = CLOCK_SPEED_KHZ;
+    uint vco, postdiv1, postdiv2;
+    if (f_open(&fp, CLOCK_FILE, FA_READ) == FR_OK) {
+        if (f_gets(buf, sizeof(buf), &fp)) {
+            uint32_t v = strtoul(buf, NULL, 10);
+            if (v >= 125000 && v <= 300000 && check_sys_clock_khz(v, &vco, &postdiv1, &postdiv2)) {
+                khz = v;
+            }
+        }
+        f_close(&fp);
+    }
+    fdebug("Clock %u kHz", khz);
+    return khz;
+}
+
 PIO pio = pio0;
 uint sm = 0;
+#ifdef LATENCY_MEASURE
+#include "latency.h"
+uint latency_sm = 1;
+// the LED pin doubles as a marker that is switched to output together with the data bus
+#define LATENCY_MARKER_GPIO PICO_DEFAULT_LED_PIN
+#define BUS_OE_MASK (DATA_BUS_MASK | (1 << LATENCY_MARKER_GPIO))
+
+// Clock calibration
+// The CPC is reset and run for CALIBRATE_SAMPLE_MS at each speed while the latency histogram
+// is collected. The lowest speed whose worst case latency plus the margin is within
+// LATENCY_BUDGET_NS is saved to CLOCK_FILE, and a report is written to CALIBRATE_FILE.
+#define CALIBRATE_FILE          "CALIB.TXT"
+#define CALIBRATE_SAMPLE_MS     1000
+#define CALIBRATE_MIN_SAMPLES   10000
+// same set as the CMake variants, fastest first
+static const uint32_t calibrate_khz[] = { 270000, 260000, 250000, 240000, 230000, 220000, 210000, 200000 };
+#define CALIBRATE_STEPS count_of(calibrate_khz)
+static int calibrate_step = -1; // -1 = not calibrating
+static int calibrate_margin_ns;
+static uint32_t calibrate_worst_ns[CALIBRATE_STEPS];
+static uint32_t calibrate_samples[CALIBRATE_STEPS];
+static absolute_time_t calibrate_deadline;
+
+static void calibrate_run_step(void) {
+    CPC_ASSERT_RESET();
+    set_sys_clock_khz(calibrate_khz[calibrate_step], true);
+    latency_reset();
+    sleep_ms(10);
+    calibrate_deadline = make_timeout_time_ms(CALIBRATE_SAMPLE_MS);
+    CPC_RELEASE_RESET();
+}
+
+void calibrate_start(int margin_ns) {
+    calibrate_margin_ns = margin_ns;
+    calibrate_step = 0;
+    calibrate_run_step();
+}
+
+// called while waiting for latch bytes
+void __not_in_flash_func(calibrate_poll)(void) {
+    FIL fp;
+    uint32_t best = 0;
+    bool failed = false;
+    if (calibrate_step < 0 || !time_reached(calibrate_deadline)) return;
+    latency_poll();
+    calibrate_worst_ns[calibrate_step] = latency_ns(latency_stats()->worst);
+    calibrate_samples[calibrate_step] = latency_stats()->count;
+    if (++calibrate_step < CALIBRATE_STEPS) {
+        calibrate_run_step();
+        return;
+    }
+    CPC_ASSERT_RESET();
+    f_open(&fp, CALIBRATE_FILE, FA_CREATE_ALWAYS|FA_WRITE);
+    f_printf(&fp, "budget %d ns margin %d ns\n", LATENCY_BUDGET_NS, calibrate_margin_ns);
+    for (int i=0;i<CALIBRATE_STEPS;i++) {
+        bool pass = calibrate_samples[i] >= CALIBRATE_MIN_SAMPLES &&
+            calibrate_worst_ns[i] + calibrate_margin_ns <= LATENCY_BUDGET_NS;
+        f_printf(&fp, "%u kHz worst %u ns samples %u %s\n", calibrate_khz[i], calibrate_worst_ns[i],
+            calibrate_samples[i], pass ? "pass" : "FAIL");
+        // speeds are tried fastest first, stop at the first failure
+        if (!pass) failed = true;
+        else if (!failed) best = calibrate_khz[i];
+    }
+    if (best) {
+        f_printf(&fp, "using %u kHz\n", best);
+    } else {
+        f_printf(&fp, "no speed passed, using %u kHz\n", CLOCK_SPEED_KHZ);
+    }
+    f_close(&fp);
+    if (best && f_open(&fp, CLOCK_FILE, FA_CREATE_ALWAYS|FA_WRITE) == FR_OK) {
+        f_printf(&fp, "%u\n", best);
+        f_close(&fp);
+    }
+    set_sys_clock_khz(best ? best : CLOCK_SPEED_KHZ, true);
+    latency_reset();
+    calibrate_step = -1;
+    log_flush();
+    CPC_RELEASE_RESET();
+}
+#else
+#define BUS_OE_MASK DATA_BUS_MASK
+#endif
+
+#ifdef TRACE_CAPTURE
+#include "trace.h"
+#endif
+
+// Command channels. Commands come from the latch (picorom.s) or from USB CDC (usbcmd.c) and
+// share dispatch(). cmd_get() reads parameters from the channel the command came in on and
+// respond() publishes resp on it.
+static uint8_t *resp;       // response buffer of the running command
+static bool cmd_from_usb;
+static bool latch_idle;     // handle_latch() is between commands, so USB may run one
+static void usb_command_poll(void);
+
+// scrub the ROMs, run USB, keep the latency FIFO drained and watch for the trace trigger while
+// core 0 waits for the latch
+static void __not_in_flash_func(latch_poll)(void) {
+    scrub_poll();
+    live_poll();
+    bulk_load_poll();
+#ifndef DEBUG_TO_SERIAL
+    if (latch_idle) usb_command_poll();
+#endif
+#ifdef LATENCY_MEASURE
+    latency_poll();
+    calibrate_poll();
+#endif
+#ifdef TRACE_CAPTURE
+    trace_poll();
+#endif
+}
+
+// next byte of a latch command, only called while core 0 owns the latch
+static inline uint32_t __not_in_flash_func(latch_get)(void) {
+    while (pio_sm_is_rx_fifo_empty(pio, sm)) latch_poll();
+    return pio_sm_get(pio, sm);
+}
+
+// next parameter byte of the running command
+static uint32_t __not_in_flash_func(cmd_get)(void) {
+    return cmd_from_usb ? usbcmd_get() : latch_get();
+}
+
+// a USB command whose parameters stopped coming, it must not act on the zeros read instead
+static inline bool cmd_aborted(void) {
+    return cmd_from_usb && usbcmd_aborted();
+}
+
+// the response in resp is complete
+static void __not_in_flash_func(respond)(void) {
+    resp[RESP_SEQ]++;
+    if (cmd_from_usb) usbcmd_respond(resp);
+}
 
-void __not_in_flash_func(emulate)(void)
+#ifdef BUS_PROFILE
+// Bus profiler counters. Row NUM_ROM_BANKS is the lower ROM
+#define PROFILE_PAGES   (ROM_SIZE/256)
+#define PROFILE_LOWER   NUM_ROM_BANKS
+#define PROFILE_FILE    "PROFILE.CSV"
+static uint32_t page_counts[NUM_ROM_BANKS+1][PROFILE_PAGES];
+static uint32_t select_counts[256];
+#endif
+
+// Who reads the latch FIFO. Core 1 applies ROM selects itself between bus accesses, so a
+// select never waits for core 0, which may be busy with USB for milliseconds. At a command
+// prefix it hands the latch to core 0, which reads the command and its parameters and hands it
+// back when the command is done. Selects written meanwhile wait in the FIFO, in order.
+#define LATCH_CORE1     0
+#define LATCH_CORE0     1
+static volatile uint8_t latch_owner = LATCH_CORE1;
+
+// A byte written to the latch while core 1 owns it: a ROM select, the command prefix or one of
+// the ignored values. Returns the selected bank.
+static inline __attribute__((always_inline)) uint8_t latch_select(uint8_t latch, uint8_t bank)
 {
+    if (latch == CMD_PREFIX_BYTE) {
+        latch_owner = LATCH_CORE0;
+        return bank;
+    }
+    if (latch >= 0xfd) return bank;
+#ifdef BUS_PROFILE
+    select_counts[latch]++;
+#endif
+    latch_selects++;
+    bank = latch < NUM_ROM_BANKS && (upper_roms & (1<<latch)) ? latch : NO_ROM;
+    rom_bank = bank;    // for core 0's commands and |ROMS
+    return bank;
+}
+
+// Bus loop shapes. Each is compiled as its own loop, and start_bus_loop() runs the one that
+// suits the loaded ROMs, so the common cases skip tests that can never pass.
+#define BUS_LOWER_ONLY  0   // no upper ROMs, upper ROM reads are left to the CPC
+#define BUS_SINGLE      1   // one upper ROM, in single_bank
+#define BUS_BANKED      2   // any set of upper ROMs
+#define BUS_INTERPOLATED 3  // any set of upper ROMs, addresses from the core 1 interpolator
+
+static uint8_t single_bank;
+
+static inline __attribute__((always_inline)) void bus_loop(const int shape)
+{
+    const uint8_t *single = UPPER_ROMS[single_bank];
+    uint8_t bank = rom_bank;    // only core 1 changes it while the loop runs
+    const uint32_t latch_empty = 1u << (PIO_FSTAT_RXEMPTY_LSB + sm);
+    io_ro_32 *latch_rx = &pio->rxf[sm];
+    if (shape == BUS_INTERPOLATED) {
+        // lane 0 gives LOWER_ROM + address, lane 1 the selected upper ROM + the same address
+        interp_config cfg = interp_default_config();
+        interp_config_set_mask(&cfg, 0, 13);
+        interp_set_config(interp0, 0, &cfg);
+        interp_config_set_cross_input(&cfg, true);
+        interp_set_config(interp0, 1, &cfg);
+        interp0->base[0] = (uintptr_t)LOWER_ROM;
+        interp0->base[1] = (uintptr_t)UPPER_ROMS[bank == NO_ROM ? 0 : bank];
+    }
+#ifdef BUS_PROFILE
+    uint32_t last = ROMEN_MASK;
+#endif
     while(1) {
         uint32_t gpio = gpio_get_all();
-        uint8_t data;
-        if ((gpio & ROMEN_MASK) == 0) {
+        if (shape == BUS_INTERPOLATED && (gpio & ROMEN_MASK) == 0) {
+            interp0->accum[0] = gpio;
             if (gpio & A15_MASK) {
-                if (rom_bank == NO_ROM) {
+                if (bank == NO_ROM) {
+                    // set data bus as input (HiZ)
+                    gpio_set_dir_in_masked(BUS_OE_MASK);
+                } else {
+                    gpio_put_masked(DATA_BUS_MASK, *(const uint8_t *)interp0->peek[1] << 14);
+                    gpio_set_dir_out_masked(BUS_OE_MASK);
+                }
+            } else {
+                gpio_put_masked(DATA_BUS_MASK, *(const uint8_t *)interp0->peek[0] << 14);
+                gpio_set_dir_out_masked(BUS_OE_MASK);
+            }
+#ifdef BUS_PROFILE
+            uint8_t row = (gpio & A15_MASK) ? bank : PROFILE_LOWER; // NO_ROM is not counted
+            if (row <= PROFILE_LOWER && ((gpio ^ last) & (ADDRESS_BUS_MASK|A15_MASK|ROMEN_MASK))) {
+                page_counts[row][(gpio&ADDRESS_BUS_MASK) >> 8]++;
+            }
+#endif
+        } else if ((gpio & ROMEN_MASK) == 0) {
+            if (gpio & A15_MASK) {
+                // bank is NO_ROM unless the selected bank is loaded
+                if (shape == BUS_LOWER_ONLY || bank == NO_ROM) {
                      // set data bus as input (HiZ)
-                    gpio_set_dir_in_masked(DATA_BUS_MASK);
+                    gpio_set_dir_in_masked(BUS_OE_MASK);
                 } else {
                     // output upper ROM data
-                    gpio_put_masked(DATA_BUS_MASK, UPPER_ROMS[rom_bank][gpio&ADDRESS_BUS_MASK] << 14);
-                    gpio_set_dir_out_masked(DATA_BUS_MASK);
+                    const uint8_t *rom = shape == BUS_SINGLE ? single : UPPER_ROMS[bank];
+                    gpio_put_masked(DATA_BUS_MASK, rom[gpio&ADDRESS_BUS_MASK] << 14);
+                    gpio_set_dir_out_masked(BUS_OE_MASK);
+#ifdef BUS_PROFILE
+                    // count once per access, after the data is on the bus
+                    if ((gpio ^ last) & (ADDRESS_BUS_MASK|A15_MASK|ROMEN_MASK)) {
+                        page_counts[bank][(gpio&ADDRESS_BUS_MASK) >> 8]++;
+                    }
+#endif
                 }
             } else {
                 // output lower ROM data
                 gpio_put_masked(DATA_BUS_MASK, LOWER_ROM[gpio&ADDRESS_BUS_MASK] << 14);
-                gpio_set_dir_out_masked(DATA_BUS_MASK);
+                gpio_set_dir_out_masked(BUS_OE_MASK);
+#ifdef BUS_PROFILE
+                if ((gpio ^ last) & (ADDRESS_BUS_MASK|A15_MASK|ROMEN_MASK)) {
+                    page_counts[PROFILE_LOWER][(gpio&ADDRESS_BUS_MASK) >> 8]++;
+                }
+#endif
             }
         } else {                           
             // set data bus as input (HiZ)
-            gpio_set_dir_in_masked(DATA_BUS_MASK);
+            gpio_set_dir_in_masked(BUS_OE_MASK);
+            // apply ROM selects between accesses, one per pass
+            if (!(pio->fstat & latch_empty) && latch_owner == LATCH_CORE1) {
+                bank = latch_select(*latch_rx, bank);
+                if (shape == BUS_INTERPOLATED) {
+                    interp0->base[1] = (uintptr_t)UPPER_ROMS[bank == NO_ROM ? 0 : bank];
+                }
+            }
         }
+#ifdef BUS_PROFILE
+        last = gpio;
+#endif
     }
 }
 
-#define RESP_BUF        0x3F00
-#define CMD_PREFIX_BYTE 0xfc
+// these run from scratch X, next to the core 1 stack
+void __scratch_x("emulate") emulate_lower_only(void) { bus_loop(BUS_LOWER_ONLY); }
+void __scratch_x("emulate") emulate_single(void) { bus_loop(BUS_SINGLE); }
+void __scratch_x("emulate") emulate_banked(void) { bus_loop(BUS_BANKED); }
+#ifdef BUS_INTERP
+void __scratch_x("emulate") emulate_interp(void) { bus_loop(BUS_INTERPOLATED); }
+#endif
 
-#define CMD_PICOLOAD    0xff
-#define CMD_LED         0xfe
-#define CMD_ROMDIR1		0xfd
-#define CMD_ROMDIR2		0xfc
-#define CMD_ROMLIST1	0xfb
-#define CMD_ROMLIST2    0xfa
-#define CMD_ROMIN       0xf9
-#define CMD_ROMOUT      0xf8
-#define CMD_ROMSET      0xf7
+// (Re)start core 1 with the bus loop for the loaded ROMs. Only called with the CPC in reset,
+// as core 1 is reset and relaunched (a FIFO handshake with the boot ROM) when the shape changes.
+static const char *bus_loop_name = "none";    // the running loop, for the latency report
 
-void __not_in_flash_func(handle_latch)(void)
+static void start_bus_loop(void)
 {
-    int cmd = 0;
-    int list_index = 0;
+    static void (*running)(void) = NULL;
+    static uint8_t running_bank;
+#ifdef BUS_INTERP
+    void (*loop)(void) = emulate_interp;
+    const char *name = "interp";
+#else
+    void (*loop)(void) = emulate_banked;
+    const char *name = "banked";
+#endif
+    if (upper_roms == 0) {
+        loop = emulate_lower_only;
+        name = "lower only";
+    } else if ((upper_roms & (upper_roms - 1)) == 0) {
+        loop = emulate_single;
+        name = "single";
+        single_bank = __builtin_ctz(upper_roms);
+    }
+    if (loop == running && (loop != emulate_single || single_bank == running_bank)) return;
+    if (running) multicore_reset_core1();
+    fdebug("bus loop %s", name);
+    running = loop;
+    running_bank = single_bank;
+    bus_loop_name = name;
+#ifdef LATENCY_MEASURE
+    // each histogram is for one loop, so the loops can be compared
+    if (calibrate_step < 0) latency_reset();
+#endif
+    multicore_launch_core1(loop);
+    bus_loop_starts++;
+}
+
+
+// PSAVE framing
+#define PSAVE_FRAME_SIZE    256     // max data bytes per frame, followed by CRC16 (lo, hi)
+#define PSAVE_MAX_RETRIES   5       // consecutive bad frames before we give up
+#define PSAVE_STATUS_OK     0
+#define PSAVE_STATUS_ERROR  1       // abort, response string holds the reason
+#define PSAVE_STATUS_RETRY  2       // bad CRC or FIFO overrun - CPC resends the frame
+
+// CRC-16/CCITT (poly 0x1021, init 0xffff). Must match crc16 in picorom.s
+static inline uint16_t crc16_update(uint16_t crc, uint8_t data) {
+    crc ^= (uint16_t)data << 8;
+    for (int i=0;i<8;i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+// Receive a file from the CPC.
+// 0xfc CMD_PSAVE <name len> <name> <size lo> <size hi>, then frames of up to PSAVE_FRAME_SIZE bytes
+// each followed by CRC16 lo, hi. Every frame is acknowledged via RESP_BUF, so the CPC can never
+// send faster than we drain the PIO FIFO, and flash writes happen while the CPC is waiting.
+void __not_in_flash_func(psave)(void)
+{
+    const uint32_t stall_mask = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+    char name[256];
+    FIL fp;
+    FRESULT fr;
+    UINT bw;
+    int retries = 0;
+    uint32_t errors = 0;
+    uint32_t received = 0;
+    uint32_t buffered = 0;
+    uint64_t start_us;
+    uint64_t write_us = 0;
+
+    memset(name, 0, sizeof(name));
+    int len = cmd_get() & 0xff; // get string length
+    for (int i=0;i<len;i++) {
+        name[i] = cmd_get() & 0xff;
+    }
+    uint32_t size = cmd_get() & 0xff;
+    size |= (cmd_get() & 0xff) << 8;
+    if (cmd_aborted()) return;
+    fdebug("PSAVE %s %u bytes", name, size);
+
+    resp[2] = 1; // string
+    if (f_open(&fp, name, FA_CREATE_ALWAYS|FA_WRITE) != FR_OK) {
+        resp[1] = PSAVE_STATUS_ERROR;
+        strcpy((char *)&resp[3], "Failed to create file");
+        respond();
+        return;
+    }
+    // keep the file in one run of clusters if there is room, for fast loads later
+    f_expand(&fp, size, 0);
+    // write in whole clusters where we can
+    uint32_t chunk = filesystem.csize * filesystem.ssize;
+    if (chunk > sizeof(psave_buf)) chunk = sizeof(psave_buf);
+
+    // ready for data
+    resp[1] = PSAVE_STATUS_OK;
+    respond();
+    start_us = time_us_64();
+    while (received < size) {
+        uint32_t n = MIN(size - received, PSAVE_FRAME_SIZE);
+        uint8_t *p = &psave_buf[buffered];
+        uint16_t crc = 0xffff;
+        pio->fdebug = stall_mask; // clear sticky RX stall flag
+        for (uint32_t i=0;i<n;i++) {
+            p[i] = cmd_get() & 0xff;
+            crc = crc16_update(crc, p[i]);
+        }
+        uint16_t frame_crc = cmd_get() & 0xff;
+        frame_crc |= (cmd_get() & 0xff) << 8;
+        if (cmd_aborted()) {
+            f_close(&fp);
+            f_unlink(name);
+            return;
+        }
+        if (frame_crc != crc || (pio->fdebug & stall_mask)) {
+            errors++;
+            if (++retries > PSAVE_MAX_RETRIES) {
+                f_close(&fp);
+                f_unlink(name);
+                resp[1] = PSAVE_STATUS_ERROR;
+                sprintf((char *)&resp[3], "Transfer failed at %u", received);
+                respond();
+                return;
+            }
+            resp[1] = PSAVE_STATUS_RETRY;
+            respond();
+            continue;
+        }
+        retries = 0;
+        buffered += n;
+        received += n;
+        if (buffered >= chunk || received == size) {
+            uint64_t t = time_us_64();
+            fr = f_write(&fp, psave_buf, buffered, &bw);
+            write_us += time_us_64() - t;
+            if (fr != FR_OK || bw != buffered) {
+                f_close(&fp);
+                f_unlink(name);
+                resp[1] = PSAVE_STATUS_ERROR;
+                sprintf((char *)&resp[3], "Write failed fr=%d", fr);
+                respond();
+                return;
+            }
+            buffered = 0;
+        }
+        if (received < size) {
+            resp[1] = PSAVE_STATUS_OK;
+            respond();
+        }
+    }
+    f_close(&fp);
+    romindex_invalidate();
+    dircache_invalidate();
+    // latch rate excludes the time the CPC spent waiting for flash writes
+    uint64_t latch_us = time_us_64() - start_us - write_us;
+    sprintf((char *)&resp[3], "Saved %u bytes %u B/s retries:%u",
+        size, latch_us ? (uint32_t)((uint64_t)size * 1000000 / latch_us) : 0, errors);
+    fdebug("%s write:%uus", (char *)&resp[3], (uint32_t)write_us);
+    resp[1] = PSAVE_STATUS_OK;
+    respond();
+}
+
+#ifdef BUS_PROFILE
+// Write all non zero profile counters to PROFILE_FILE
+bool write_profile(void) {
+    FIL fp;
+    if (f_open(&fp, PROFILE_FILE, FA_CREATE_ALWAYS|FA_WRITE) != FR_OK) return false;
+    f_printf(&fp, "type,bank,page,count\n");
+    for (int bank=0;bank<=NUM_ROM_BANKS;bank++) {
+        for (int page=0;page<PROFILE_PAGES;page++) {
+            if (page_counts[bank][page]) {
+                if (bank == PROFILE_LOWER) {
+                    f_printf(&fp, "access,L,%d,%u\n", page, page_counts[bank][page]);
+                } else {
+                    f_printf(&fp, "access,%d,%d,%u\n", bank, page, page_counts[bank][page]);
+                }
+            }
+        }
+    }
+    for (int rom=0;rom<256;rom++) {
+        if (select_counts[rom]) f_printf(&fp, "select,%d,,%u\n", rom, select_counts[rom]);
+    }
+    return f_close(&fp) == FR_OK;
+}
+
+// One summary line per bank: accesses, pages touched and latch selects
+void __not_in_flash_func(profile_response)(int bank)
+{
+    if (bank > NUM_ROM_BANKS) {
+        resp[1] = 1; // done
+    } else {
+        uint32_t total = 0;
+        int pages = 0;
+        for (int page=0;page<PROFILE_PAGES;page++) {
+            total += page_counts[bank][page];
+            if (page_counts[bank][page]) pages++;
+        }
+        if (bank == PROFILE_LOWER) {
+            sprintf((char *)&resp[3], " L: %10u %2d/%d", total, pages, PROFILE_PAGES);
+        } else {
+            sprintf((char *)&resp[3], "%2d: %10u %2d/%d %8u", bank, total, pages, PROFILE_PAGES, select_counts[bank]);
+        }
+        resp[1] = 0; // status=OK
+        resp[2] = 1; // string
+    }
+    respond();
+}
+#endif
+
+#ifdef LATENCY_MEASURE
+// Latency histogram, one line per non empty bin from list_index. Returns the next bin to show
+int __not_in_flash_func(latency_response)(int bin)
+{
+    const latency_stats_t *stats = latency_stats();
+    while (bin < LATENCY_BINS && stats->bins[bin] == 0) bin++;
+    if (bin >= LATENCY_BINS) {
+        resp[1] = 1; // done
+    } else {
+        sprintf((char *)&resp[3], "%s%3u clk %4u ns %10u", bin == LATENCY_BINS - 1 ? ">=" : "  ",
+            latency_clocks(bin), latency_ns(bin), stats->bins[bin]);
+        resp[1] = 0; // status=OK
+        resp[2] = 1; // string
+        bin++;
+    }
+    respond();
+    return bin;
+}
+#endif
+
+// Write one ROM index entry to the response buffer, or end of list
+void __not_in_flash_func(index_response)(bool found, const romindex_entry_t *entry, bool show_rsx)
+{
+    if (!found) {
+        resp[1] = 1; // done
+    } else {
+        if (show_rsx) {
+            sprintf((char *)&resp[3], "%-22.22s %.16s", entry->path, entry->rsx);
+        } else {
+            sprintf((char *)&resp[3], "%-27.27s %5u %d.%d%d", entry->path, entry->size, entry->major, entry->minor, entry->patch);
+        }
+        resp[1] = 0; // status=OK
+        resp[2] = 1; // string
+    }
+    respond();
+}
+
+// Write one cached directory entry to the response buffer, or end of list
+void __not_in_flash_func(dir_response)(bool found, const char *name, const dircache_entry_t *entry)
+{
+    if (!found) {
+        resp[1] = 1; // done
+    } else {
+        if (entry->is_dir) {
+            sprintf((char *)&resp[3], "%-32.32s  <DIR>", name);
+        } else {
+            sprintf((char *)&resp[3], "%-32.32s %6u", name, entry->size);
+        }
+        resp[1] = 0; // status=OK
+        resp[2] = 1; // string
+    }
+    respond();
+}
+
+// Run one command from the latch or from USB. Parameters are read with cmd_get() and the
+// response is written to resp
+static void __not_in_flash_func(dispatch)(int cmd)
+{
+    static int list_index = 0;
     int num_params = 0;
     int params[4];
     char buf[256];
-    FRESULT res;
-    DIR dir;
-    FILINFO fno;
-    while(1) {
-        uint8_t latch =  pio_sm_get_blocking(pio, sm)  & 0xff;
-        switch(cmd) {
-            case 0:
-                switch (latch) {
-                    case CMD_PREFIX_BYTE:
-                        cmd = -1;
-                        break;
-                    case 0xfd:
-                    case 0xfe:
-                    case 0xff:
-                        break;
-                    default:
-                        rom_bank = latch;
-                        if (rom_bank >= NUM_ROM_BANKS) rom_bank = NO_ROM;
-                        else if ((upper_roms & (1<<rom_bank)) == 0) rom_bank = NO_ROM;
+    romindex_entry_t entry;
+    const char *name = NULL;
+    const dircache_entry_t *dentry = NULL;
+    bool found;
+    sprintf((char *)&resp[0x40], "cmd:%d list_index:%d rom_bank:%d NUM_ROM_BANKS:%d upper_roms:0x%02x", 
+        cmd, list_index, rom_bank, NUM_ROM_BANKS, upper_roms);
+    debug((char *)&resp[0x40]);
+    switch(cmd) {
+        case CMD_ROMDIR1: // list all ROMs from the index
+            index_response(romindex_first(NULL, &entry), &entry, false);
+            break;
+        case CMD_ROMDIR2: // next ROM
+            index_response(romindex_next(&entry), &entry, false);
+            break;
+        case CMD_ROMFIND1: // search the index
+            memset(buf, 0, sizeof(buf));
+            num_params = cmd_get() & 0xff; // get string length
+            for (int i=0;i<num_params;i++) {
+                buf[i] = cmd_get() & 0xff;  // read string info buffer
+            }
+            if (cmd_aborted()) return;
+            index_response(romindex_first(buf, &entry), &entry, true);
+            break;
+        case CMD_ROMFIND2: // next match
+            index_response(romindex_next(&entry), &entry, true);
+            break;
+        case CMD_DIR1: // browse a directory: <sort> <page> <path len> <path>
+            memset(buf, 0, sizeof(buf));
+            params[0] = cmd_get() & 0xff; // sort
+            params[1] = cmd_get() & 0xff; // page
+            num_params = cmd_get() & 0xff; // get string length
+            for (int i=0;i<num_params;i++) {
+                buf[i] = cmd_get() & 0xff;  // read string info buffer
+            }
+            if (cmd_aborted()) return;
+            // name and dentry are only set by the call, so not in the same argument list
+            found = dircache_first(buf, params[0], params[1], &name, &dentry);
+            dir_response(found, name, dentry);
+            break;
+        case CMD_DIR2: // next directory entry
+            found = dircache_next(&name, &dentry);
+            dir_response(found, name, dentry);
+            break;
+        case CMD_ROMLIST1: {
+            // version of the ROM the command came from, picorom.rom when it is the CPC
+            const uint8_t *from = UPPER_ROMS[rom_bank == NO_ROM ? 0 : rom_bank];
+            list_index = 0;
+            sprintf((char *)&resp[3], "FW: %d.%d.%d %d MHz ROM: %d.%d%d ROMS: %04X%s", 
+                    VER_MAJOR, VER_MINOR, VER_PATCH,
+                    clock_get_hz(clk_sys)/1000000,
+                    from[1],from[2],from[3],
+                    upper_roms, rom_check_text(CHECK_LOWER)
+                );
+            debug((char *)&resp[3]);
+            resp[1] = 0; // status=OK
+            resp[2] = 1; // string
+            respond();
+            break;
+        }
+        case CMD_ROMLIST2: // next rom
+            if (list_index < NUM_ROM_BANKS) {
+                uint8_t type = UPPER_ROMS[list_index][0];
+                uint8_t major = UPPER_ROMS[list_index][1];
+                uint8_t minor = UPPER_ROMS[list_index][2];
+                uint8_t patch = UPPER_ROMS[list_index][3];
+                if (upper_roms & (1<<list_index)) {
+                    buf[0] = 0; // ensure buf is null terminated
+                    if (type < 2 || type == 0x80) {
+                        uint16_t name_table = (((uint16_t)UPPER_ROMS[list_index][5] << 8) + UPPER_ROMS[list_index][4]) - 0xc000;
+                        int i=0;
+                        do {
+                            buf[i] = UPPER_ROMS[list_index][name_table+i] & 0x7f;
+                        } while(i <31 && UPPER_ROMS[list_index][name_table+i++]< 0x80);
+                        buf[i] = 0;
+                    } else if (type == 2) {
+                        strcpy(buf, "-extension ROM- ");
+                    }
+                    sprintf((char *)&resp[3], "%2d: %02x %-16s %d.%d%d%s", 
+                        list_index, 
+                        type, 
+                        buf,
+                        major, 
+                        minor, 
+                        patch,
+                        rom_check_text(list_index)
+                    );
+                } else {
+                    sprintf((char *)&resp[3], "%2d: -- Not present", list_index);
                 }
-                break;
-            case -1:
-                cmd = latch;
-                num_params = 0;
-                sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+0x40], "cmd:%d list_index:%d rom_bank:%d NUM_ROM_BANKS:%d upper_roms:0x%02x", 
-                    cmd, list_index, rom_bank, NUM_ROM_BANKS, upper_roms);
-                debug((char *)&UPPER_ROMS[rom_bank][RESP_BUF+0x40]);
-                switch(cmd) {
-                    case CMD_ROMDIR1: // dir
-                        res = f_opendir(&dir, "/");  
-                        // fall through
-                    case CMD_ROMDIR2: // next dir
-                        res = f_readdir(&dir, &fno);  
-                        if (res != FR_OK || fno.fname[0] == 0) {
-                            f_closedir(&dir);
-                            UPPER_ROMS[rom_bank][RESP_BUF+1] = 1; // done
-                        } else {
-                            sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "%-32s %6u", fno.fname, fno.fsize);
-                            UPPER_ROMS[rom_bank][RESP_BUF+1] = 0; // status=OK
-                            UPPER_ROMS[rom_bank][RESP_BUF+2] = 1; // string
-                        }
-                        UPPER_ROMS[rom_bank][RESP_BUF]++;
-                        cmd = 0;
-                        break;
-                    case CMD_ROMLIST1:
-                        list_index = 0;
-                        sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "FW: %d.%d.%d %d MHz ROM: %d.%d%d ROMS: %04X", 
-                                VER_MAJOR, VER_MINOR, VER_PATCH,
-                                clock_get_hz(clk_sys)/1000000,
-                                UPPER_ROMS[rom_bank][1],UPPER_ROMS[rom_bank][2],UPPER_ROMS[rom_bank][3],
-                                upper_roms
-                            );
-                        debug((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3]);
-                        UPPER_ROMS[rom_bank][RESP_BUF+1] = 0; // status=OK
-                        UPPER_ROMS[rom_bank][RESP_BUF+2] = 1; // string
-                        UPPER_ROMS[rom_bank][RESP_BUF]++;
-                        cmd = 0;
-                        break;
-                    case CMD_ROMLIST2: // next rom
-                        if (list_index < NUM_ROM_BANKS) {
-                            uint8_t type = UPPER_ROMS[list_index][0];
-                            uint8_t major = UPPER_ROMS[list_index][1];
-                            uint8_t minor = UPPER_ROMS[list_index][2];
-                            uint8_t patch = UPPER_ROMS[list_index][3];
-                            if (upper_roms & (1<<list_index)) {
-                                buf[0] = 0; // ensure buf is null terminated
-                                if (type < 2 || type == 0x80) {
-                                    uint16_t name_table = (((uint16_t)UPPER_ROMS[list_index][5] << 8) + UPPER_ROMS[list_index][4]) - 0xc000;
-                                    int i=0;
-                                    do {
-                                        buf[i] = UPPER_ROMS[list_index][name_table+i] & 0x7f;
-                                    } while(i <31 && UPPER_ROMS[list_index][name_table+i++]< 0x80);
-                                    buf[i] = 0;
-                                } else if (type == 2) {
-                                    strcpy(buf, "-extension ROM- ");
-                                }
-                                sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "%2d: %02x %-16s %d.%d%d", 
-                                    list_index, 
-                                    type, 
-                                    buf,
-                                    major, 
-                                    minor, 
-                                    patch
-                                );
-                            } else {
-                                sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "%2d: -- Not present", list_index);
-                            }
-                            debug((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3]);
-                            UPPER_ROMS[rom_bank][RESP_BUF+1] = 0; // status=OK
-                            UPPER_ROMS[rom_bank][RESP_BUF+2] = 1; // string
-                            list_index++;
-                        } else {
-                            UPPER_ROMS[rom_bank][RESP_BUF+1] = 1; // status
-                            debug("End of ROM list");
-                        }
-                        UPPER_ROMS[rom_bank][RESP_BUF]++;
-                        cmd = 0;
-                        break;              
-                    case CMD_ROMIN: // Load ROM into bank
-                        num_params = 1;
-                        break;
-                    case CMD_ROMOUT: // unload ROM from bank
-                    case CMD_LED: 
-                        num_params = 1;
-                        break;
-                    case CMD_ROMSET:
-                        memset(buf, 0, sizeof(buf));
-                        num_params =  pio_sm_get_blocking(pio, sm)  & 0xff; // get string length
-                        for (int i=0;i<num_params;i++) {
-                            buf[i] = pio_sm_get_blocking(pio, sm)  & 0xff;  // read string info buffer
-                        }
-                        sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+0x80], "np:%d buf:%s", num_params, buf); // debug
-                        if (!load_config(buf)) {
-                            UPPER_ROMS[rom_bank][RESP_BUF+1] = 0; // status=OK
-                            UPPER_ROMS[rom_bank][RESP_BUF+2] = 1; // string
-                            strcpy((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "Failed to load Config");
-                            UPPER_ROMS[rom_bank][RESP_BUF]++;
-                        } else {
-                            CPC_ASSERT_RESET();
-                            sleep_ms(10);
-                            CPC_RELEASE_RESET();
-                        }
-                        cmd = 0;
-                        break;
-                    case CMD_PICOLOAD:
-                        CPC_ASSERT_RESET();
-                        usb_mode();
-                        //reset_usb_boot(0, 0);
-                        UPPER_ROMS[rom_bank][RESP_BUF]++;
-                        cmd = 0;
-                        break;
-                    default:
-                        break;
+                debug((char *)&resp[3]);
+                resp[1] = 0; // status=OK
+                resp[2] = 1; // string
+                list_index++;
+            } else {
+                resp[1] = 1; // status
+                debug("End of ROM list");
+            }
+            respond();
+            break;              
+        case CMD_TRACE: { // mode, window (lo, hi), address (lo, hi)
+            int mode = cmd_get() & 0xff;
+            uint32_t window = cmd_get() & 0xff;
+            window |= (cmd_get() & 0xff) << 8;
+            uint16_t address = cmd_get() & 0xff;
+            address |= (cmd_get() & 0xff) << 8;
+            if (cmd_aborted()) return;
+#ifdef TRACE_CAPTURE
+            if (mode == TRACE_MODE_SAVE) {
+                int events = trace_save();
+                if (events < 0) {
+                    strcpy((char *)&resp[3], "Failed to write trace");
+                } else {
+                    sprintf((char *)&resp[3], "%d events saved", events);
                 }
-                break;
-            default:
-                // load params
-                if (num_params > 0) {
-                    num_params--;
-                    params[num_params] = latch;
+                resp[1] = events < 0;
+            } else {
+                trace_start(mode, window ? window : TRACE_EVENTS / 2, address);
+                if (mode == TRACE_MODE_ADDRESS) {
+                    sprintf((char *)&resp[3], "Trace armed at &%04X", address);
+                } else {
+                    strcpy((char *)&resp[3], "Trace started");
                 }
-                if (num_params == 0) {
-                    switch (cmd) {
-                        case CMD_ROMIN:
-                            // get filename
-                            memset(buf, 0, sizeof(buf));
-                            num_params =  pio_sm_get_blocking(pio, sm)  & 0xff; // get string length
-                            for (int i=0;i<num_params;i++) {
-                                buf[i] = pio_sm_get_blocking(pio, sm)  & 0xff;  // read string info buffer
-                            }
-                            sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "ROMIN,%d, %s", params[0], buf);
-                            if ((params[0] >= NUM_ROM_BANKS) || (params[0] < 0)) {
-                                UPPER_ROMS[rom_bank][RESP_BUF+1] = 0; // status=OK
-                                UPPER_ROMS[rom_bank][RESP_BUF+2] = 1; // string
-                                strcpy((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "Invalid bank number");
-                                UPPER_ROMS[rom_bank][RESP_BUF]++;
-                            } else if (!load_upper_rom(buf, params[0])) {
-                                UPPER_ROMS[rom_bank][RESP_BUF+1] = 0; // status=OK
-                                UPPER_ROMS[rom_bank][RESP_BUF+2] = 1; // string
-                                strcpy((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "Failed to load ROM");
-                                UPPER_ROMS[rom_bank][RESP_BUF]++;
-                            } else {
-                                CPC_ASSERT_RESET();
-                                sleep_ms(10);
-                                CPC_RELEASE_RESET();
-                            }
-                            break;
-                        case CMD_ROMOUT:
-                            CPC_ASSERT_RESET();
-                            sprintf((char *)&UPPER_ROMS[rom_bank][RESP_BUF+3], "ROMOUT,%d", params[0]);
-                            if (params[0] >= NUM_ROM_BANKS) params[0] = NUM_ROM_BANKS-1;
-                            if (params[0] < 0) params[0] = 0;
-                            remove_upper_rom(params[0]);
-                            UPPER_ROMS[rom_bank][RESP_BUF]++;
-                            CPC_RELEASE_RESET();
-                            break;
-                        case CMD_LED:
-                            //printf("LED,%d latch=%d num_params=%d\n", params[0], latch, num_params);
-                            gpio_put(PICO_DEFAULT_LED_PIN, params[0]!=0);
-                            UPPER_ROMS[rom_bank][RESP_BUF+1] = 0; // status=OK
-                            UPPER_ROMS[rom_bank][RESP_BUF]++;
-                            break;
-
-                    }
-                    cmd = 0;
+                resp[1] = 0; // status=OK
+            }
+#else
+            (void)mode; (void)window; (void)address;
+            strcpy((char *)&resp[3], "Not a trace build");
+            resp[1] = 1;
+#endif
+            resp[2] = 1; // string
+            respond();
+            break;
+        }
+        case CMD_ROMSET:
+            memset(buf, 0, sizeof(buf));
+            num_params = cmd_get() & 0xff; // get string length
+            for (int i=0;i<num_params;i++) {
+                buf[i] = cmd_get() & 0xff;  // read string info buffer
+            }
+            if (cmd_aborted()) return;
+            sprintf((char *)&resp[0x80], "np:%d buf:%s", num_params, buf); // debug
+            if (!load_config(buf)) {
+                resp[1] = 0; // status=OK
+                resp[2] = 1; // string
+                strcpy((char *)&resp[3], "Failed to load Config");
+                respond();
+            } else {
+                CPC_ASSERT_RESET();
+                start_bus_loop();
+                log_flush();
+                sleep_ms(10);
+                CPC_RELEASE_RESET();
+            }
+            break;
+        case CMD_PSAVE:
+            psave();
+            break;
+        case CMD_LOGFLUSH:
+            sprintf((char *)&resp[3], "%u log messages written", log_flush());
+            resp[1] = 0; // status=OK
+            resp[2] = 1; // string
+            respond();
+            break;
+#ifdef LATENCY_MEASURE
+        case CMD_LATENCY1: // write the latency file, then list the histogram
+            list_index = 0;
+            latency_poll();
+            sprintf((char *)&resp[3], "%d MHz %s loop worst %u clk %u ns margin %d ns %s",
+                clock_get_hz(clk_sys)/1000000, bus_loop_name,
+                latency_clocks(latency_stats()->worst), latency_ns(latency_stats()->worst),
+                LATENCY_BUDGET_NS - (int)latency_ns(latency_stats()->worst),
+                latency_write_file(bus_loop_name) ? "" : "(file failed)");
+            resp[1] = 0; // status=OK
+            resp[2] = 1; // string
+            respond();
+            break;
+        case CMD_LATENCY2:
+            list_index = latency_response(list_index);
+            break;
+        case CMD_LATENCY_CLR:
+            latency_reset();
+            strcpy((char *)&resp[3], "Latency cleared");
+            resp[1] = 0; // status=OK
+            resp[2] = 1; // string
+            respond();
+            break;
+#else
+        case CMD_LATENCY1:
+        case CMD_LATENCY2:
+        case CMD_LATENCY_CLR:
+            strcpy((char *)&resp[3], "Not a latency build");
+            resp[1] = (cmd == CMD_LATENCY2); // end of list
+            resp[2] = 1; // string
+            respond();
+            break;
+#endif
+#ifdef BUS_PROFILE
+        case CMD_PROFILE1: // write the profile file, then list per bank totals
+            list_index = 0;
+            sprintf((char *)&resp[3], "Bank   Accesses Pages   Selects %s",
+                write_profile() ? "" : "(file failed)");
+            resp[1] = 0; // status=OK
+            resp[2] = 1; // string
+            respond();
+            break;
+        case CMD_PROFILE2:
+            profile_response(list_index++);
+            break;
+        case CMD_PROFILE_CLR:
+            memset(page_counts, 0, sizeof(page_counts));
+            memset(select_counts, 0, sizeof(select_counts));
+            strcpy((char *)&resp[3], "Profile cleared");
+            resp[1] = 0; // status=OK
+            resp[2] = 1; // string
+            respond();
+            break;
+#else
+        case CMD_PROFILE1:
+        case CMD_PROFILE2:
+        case CMD_PROFILE_CLR:
+            strcpy((char *)&resp[3], "Not a profiling build");
+            resp[1] = (cmd == CMD_PROFILE2); // end of list
+            resp[2] = 1; // string
+            respond();
+            break;
+#endif
+        case CMD_PICOLOAD:
+            CPC_ASSERT_RESET();
+            usb_mode();
+            //reset_usb_boot(0, 0);
+            respond();
+            break;
+        case CMD_ROMIN: // Load ROM into bank: <bank> <name len> <name>
+            params[0] = cmd_get() & 0xff;
+            // get filename
+            memset(buf, 0, sizeof(buf));
+            num_params = cmd_get() & 0xff; // get string length
+            for (int i=0;i<num_params;i++) {
+                buf[i] = cmd_get() & 0xff;  // read string info buffer
+            }
+            if (cmd_aborted()) return;
+            sprintf((char *)&resp[3], "ROMIN,%d, %s", params[0], buf);
+            if ((params[0] >= NUM_ROM_BANKS) || (params[0] < 0)) {
+                resp[1] = 0; // status=OK
+                resp[2] = 1; // string
+                strcpy((char *)&resp[3], "Invalid bank number");
+                respond();
+            } else if (!load_upper_rom(buf, params[0], 0)) {
+                resp[1] = 0; // status=OK
+                resp[2] = 1; // string
+                strcpy((char *)&resp[3], "Failed to load ROM");
+                respond();
+            } else {
+                CPC_ASSERT_RESET();
+                start_bus_loop();
+                log_flush();
+                sleep_ms(10);
+                CPC_RELEASE_RESET();
+            }
+            break;
+        case CMD_ROMOUT: // unload ROM from bank: <bank>
+            params[0] = cmd_get() & 0xff;
+            if (cmd_aborted()) return;
+            CPC_ASSERT_RESET();
+            sprintf((char *)&resp[3], "ROMOUT,%d", params[0]);
+            if (params[0] >= NUM_ROM_BANKS) params[0] = NUM_ROM_BANKS-1;
+            if (params[0] < 0) params[0] = 0;
+            remove_upper_rom(params[0]);
+            respond();
+            start_bus_loop();
+            CPC_RELEASE_RESET();
+            break;
+        case CMD_CALIBRATE:
+            params[0] = cmd_get() & 0xff;
+            if (cmd_aborted()) return;
+#ifdef LATENCY_MEASURE
+            // the CPC is reset at each speed, so there is no response
+            calibrate_start(params[0]);
+#else
+            resp[1] = 1; // status
+            respond();
+#endif
+            break;
+        case CMD_ROMDATA: { // <bank> <length lo> <length hi> <data>, bank 0xff is the lower ROM
+            int bank = cmd_get() & 0xff;
+            uint32_t length = cmd_get() & 0xff;
+            length |= (cmd_get() & 0xff) << 8;
+            if (cmd_aborted()) return;
+            bool lower = bank == NO_ROM;
+            // from the CPC it would be overwriting the ROMs it is running
+            bool valid = cmd_from_usb && (lower || bank < NUM_ROM_BANKS) && length > 0 && length <= ROM_SIZE;
+            uint8_t *rom = lower ? LOWER_ROM : UPPER_ROMS[valid ? bank : 0];
+            if (valid) romcrc_abort(); // the scrub may be reading this bank
+            for (uint32_t i=0;i<length;i++) {
+                uint8_t b = cmd_get() & 0xff;
+                if (cmd_aborted()) break;
+                if (valid) rom[i] = b;
+            }
+            resp[2] = 1; // string
+            if (valid && cmd_aborted()) {
+                // part of an image, the CPC must not run it
+                if (lower) {
+                    restore_lower_rom();
+                } else {
+                    remove_upper_rom(bank);
                 }
+                return;
+            } else if (!valid) {
+                resp[1] = 1;
+                strcpy((char *)&resp[3], cmd_from_usb ? "Invalid bank or length" : "Only over USB");
+            } else {
+                rom_check_t *check = &rom_checks[lower ? CHECK_LOWER : bank];
+                check_rom(rom, length, check, "USB ROMDATA");
+                check->status = CRC_UNCHECKED;
+                if (!lower) upper_roms |= (1<<bank);
+                sprintf((char *)&resp[3], "ROMDATA,%d %u bytes crc32 %08x", bank, length, check->crc);
+                resp[1] = 0; // status=OK
+            }
+            respond();
+            break;
         }
+        case CMD_BOOT1: // boot report, one phase per line
+            list_index = 0;
+            // fall through
+        case CMD_BOOT2:
+            if (boot_line(list_index, (char *)&resp[3], ROM_SIZE - RESP_BUF - RESP_DATA)) {
+                list_index++;
+                resp[1] = 0; // status=OK
+            } else {
+                resp[1] = 1; // done
+            }
+            resp[2] = 1; // string
+            respond();
+            break;
+        case CMD_LED:
+            params[0] = cmd_get() & 0xff;
+            if (cmd_aborted()) return;
+            //printf("LED,%d latch=%d num_params=%d\n", params[0], latch, num_params);
+#ifdef LATENCY_MEASURE
+            // the LED pin is the latency marker, driving it would spoil the histogram
+            strcpy((char *)&resp[3], "LED is the latency marker");
+            resp[1] = 1;
+            resp[2] = 1; // string
+#else
+            gpio_put(PICO_DEFAULT_LED_PIN, params[0]!=0);
+            resp[1] = 0; // status=OK
+#endif
+            respond();
+            break;
+        default:
+            break;
     }
 }
 
+// Commands that only read the ROM list, the boot report or the counters, or set the LED, run
+// while the CPC runs. They don't change anything the CPC uses, and core 1 takes the ROM
+// selects meanwhile (see latch_select()), so the time they take doesn't matter. Anything else
+// holds the CPC in reset.
+static bool usb_command_is_quick(int cmd) {
+    switch (cmd) {
+        case CMD_LED:
+        case CMD_ROMLIST1:
+        case CMD_ROMLIST2:
+        case CMD_BOOT1:
+        case CMD_BOOT2:
+        case CMD_LATENCY2:
+        case CMD_LATENCY_CLR:
+        case CMD_PROFILE2:
+        case CMD_PROFILE_CLR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Run a command sent over USB CDC, see usbcmd.c. Every command is answered, including those
+// that restart the CPC rather than answering it.
+static void usb_command_poll(void) {
+    static uint8_t usb_resp[USBCMD_RESP_SIZE];
+    if (!usbcmd_ready()) return;
+    cmd_from_usb = true;
+    usb_commands++;
+    int cmd = usbcmd_get();
+    bool hold = !usb_command_is_quick(cmd);
+    if (hold) CPC_ASSERT_RESET();
+    resp = usb_resp;
+    uint8_t seq = resp[RESP_SEQ];
+    dispatch(cmd);
+    if (usbcmd_aborted()) {
+        resp[RESP_STATUS] = 1;
+        resp[RESP_TYPE] = 1;
+        strcpy((char *)&resp[RESP_DATA], "Command timed out");
+        respond();
+    } else if (resp[RESP_SEQ] == seq) {
+        resp[RESP_STATUS] = 0;
+        resp[RESP_TYPE] = 0;
+        respond();
+    }
+    cmd_from_usb = false;
+    if (hold) {
+        start_bus_loop();
+        log_flush();
+        CPC_RELEASE_RESET();
+    }
+}
+
+void __not_in_flash_func(handle_latch)(void)
+{
+    while(1) {
+        // core 1 takes the selects and gives the latch to core 0 at a command prefix
+        latch_idle = true;
+        while (latch_owner != LATCH_CORE0) latch_poll();
+        latch_idle = false;
+        uint8_t cmd = latch_get() & 0xff;
+        uint8_t bank = rom_bank;
+        resp = &UPPER_ROMS[bank == NO_ROM ? 0 : bank][RESP_BUF];
+        latch_commands++;
+        dispatch(cmd);
+        latch_owner = LATCH_CORE1;
+    }
+}
+
+static int stats_text_stats(char *buf, int size) {
+    return snprintf(buf, size, "%-20s %u\r\n%-20s %04x\r\n",
+        "uptime_ms", to_ms_since_boot(get_absolute_time()),
+        "upper_roms", upper_roms);
+}
+
+static int stats_text_banks(char *buf, int size) {
+    int len = snprintf(buf, size, "bank length crc32    check load_ms meta source\r\n");
+    char bank[4];
+    for (int i=0;i<=NUM_ROM_BANKS && len < size;i++) {
+        rom_check_t *check = &rom_checks[i];
+        if (i != CHECK_LOWER && !(upper_roms & (1<<i))) continue;
+        if (i == CHECK_LOWER) strcpy(bank, "L");
+        else sprintf(bank, "%d", i);
+        len += snprintf(buf + len, size - len, "%-4s %6u %08x %-5s %7u %4u %s\r\n",
+            bank, check->length, check->crc, *rom_check_text(i) ? rom_check_text(i) + 1 : "-",
+            check->load_us / 1000, check->meta_reads, check->source);
+    }
+    return len;
+}
+
+static void stats_init(void) {
+    stats_counter(STATS_FILE_STATS, "clock_khz", &clock_khz);
+    stats_counter(STATS_FILE_STATS, "boot_ms", &boot_ms);
+    stats_counter(STATS_FILE_STATS, "latch_selects", &latch_selects);
+    stats_counter(STATS_FILE_STATS, "latch_commands", &latch_commands);
+    stats_counter(STATS_FILE_STATS, "usb_commands", &usb_commands);
+    stats_counter(STATS_FILE_STATS, "bulk_loads", &bulk_loads);
+    stats_counter(STATS_FILE_STATS, "live_loads", &live_loads);
+    stats_counter(STATS_FILE_STATS, "bus_loop_starts", &bus_loop_starts);
+    stats_counter(STATS_FILE_STATS, "scrubs", &scrubs);
+    stats_counter(STATS_FILE_STATS, "scrub_failures", &scrub_failures);
+    stats_text(STATS_FILE_STATS, stats_text_stats);
+    stats_text(STATS_FILE_BANKS, stats_text_banks);
+    stats_text(STATS_FILE_BOOT, boot_text);
+}
+
+// true if the drive holds a FAT volume made for the other sector size, i.e. by the 512 byte
+// sector firmware when this is the 4K one or the other way round. f_mount() can't read it, but
+// it still has the user's files, so it is only formatted by a BOOTSEL long push.
+static bool drive_other_sector_size(void) {
+    uint8_t *buf = psave_buf;
+    if (disk_read(0, buf, 0, 1) != RES_OK || buf[510] != 0x55 || buf[511] != 0xaa) return false;
+    if (buf[0] == 0xeb || buf[0] == 0xe9) {
+        // no partition table, the boot sector says
+        uint16_t bps = buf[11] | buf[12] << 8;
+        return bps != DRIVE_SECTOR_SIZE && (bps == 512 || bps == 4096);
+    }
+    // the partition start is in sectors of the size it was made with
+    uint32_t lba = buf[454] | buf[455] << 8 | buf[456] << 16 | (uint32_t)buf[457] << 24;
+    int other = DRIVE_SECTOR_SIZE == 512 ? 4096 : 512;
+    uint32_t offset = lba * other;
+    if (disk_read(0, buf, offset / DRIVE_SECTOR_SIZE, 1) != RES_OK) return false;
+    buf += offset % DRIVE_SECTOR_SIZE;
+    return buf[510] == 0x55 && buf[511] == 0xaa && (buf[11] | buf[12] << 8) == other;
+}
+
 void cpc_mode() {
     CPC_ASSERT_RESET();
+    romcrc_init();
     upper_roms = 0;
     if (f_mount(&filesystem, "", 1)) {
+        if (drive_other_sector_size()) fatal(FATAL_SECTOR_SIZE);
         format();
     }
+    disk_data_start = filesystem.database;
+    boot_mark("mount", NULL);
     debug("Drive mounted");
     if (!load_config("DEFAULT.CFG")) {
         debug("default config failed");
-        if (!load_lower_rom("OS_6128.ROM")) fatal(4);
+        if (!load_lower_rom("OS_6128.ROM", 0)) fatal(4);
         debug("OS loaded");
-        if (!load_upper_rom("BASIC_1.1.ROM", 0)) fatal(5);
+        if (!load_upper_rom("BASIC_1.1.ROM", 0, 0)) fatal(5);
         debug("basic loaded");
-        load_upper_rom("picorom.rom", 1);
+        load_upper_rom("picorom.rom", 1, 0);
     }
-    set_sys_clock_khz(CLOCK_SPEED_KHZ, true);
-    multicore_launch_core1(emulate);
+    clock_khz = load_clock_config();
+    set_sys_clock_khz(clock_khz, true);
+    boot_mark("config", NULL);
+    stats_init();
+    // the USB drive shows the ROM banks in RAM while the CPC runs
+    live_init(LOWER_ROM, &UPPER_ROMS[0][0], NUM_ROM_BANKS, live_hold);
+    msc_set_live(true);
+    tud_init(BOARD_TUD_RHPORT);
+    // core 1 wins any bus contention with core 0, DMA and USB
+    bus_ctrl_hw->priority = BUSCTRL_BUS_PRIORITY_PROC1_BITS;
+    start_bus_loop();
     uint offset = pio_add_program(pio, &latch_program);
     latch_program_init(pio, sm, offset);
+#ifdef LATENCY_MEASURE
+    latency_init(pio, latency_sm, LATENCY_MARKER_GPIO);
+#endif
+#ifdef TRACE_CAPTURE
+    trace_init();
+#endif
     gpio_put(PICO_DEFAULT_LED_PIN, 1);
+    log_flush();
+    boot_ms = to_ms_since_boot(get_absolute_time());
+    boot_finish("reset release");
     CPC_RELEASE_RESET();
     handle_latch();
     debug("ERROR - should never reach here");
 }
 
 
+// no ROMEN edge this long after power up means no CPC, and the drive is shown over USB
+#define DETECT_WINDOW_MS    500
+
+static bool romen_edge(void) {
+    return io_bank0_hw->intr[ROMEN_GPIO / 8] & (GPIO_IRQ_EDGE_FALL << (4 * (ROMEN_GPIO % 8)));
+}
+
 int main() {
 #ifdef USE_XIP_CACHE_AS_RAM
     // disable XIP cache - this frees up the cache RAM for variable storage
@@ -570,27 +1671,32 @@ int main() {
     //while (!tud_cdc_connected()) { sleep_ms(100);  };
     printf("tud_cdc_connected() %s\n", __TIMESTAMP__);
     printf("__FLASH_START  0x%08x __FLASH_LEN  0x%08x\n", __FLASH_START, __FLASH_LEN);
-    printf("__DRIVE_START    0x%08x __DRIVE_LEN    0x%08x\n", __DRIVE_START, __DRIVE_LEN);
+    printf("__flash_binary_end 0x%08x flash size 0x%08x\n", __flash_binary_end, drivemap_flash_size());
 #endif
     gpio_init_mask(FULL_MASK);
     gpio_set_dir_in_masked(FULL_MASK);
     gpio_pull_down(WRITE_LATCH_GPIO); // pull down for diode OR
-    gpio_pull_up(ROMEN_GPIO); // pull ROMEN high. If this goes low within xxms of startup, then assume we are connected to CPC
+    gpio_pull_up(ROMEN_GPIO); // pull ROMEN high. If it goes low within DETECT_WINDOW_MS of startup, then assume we are connected to CPC
     gpio_put(RESET_GPIO, 0);
     gpio_init(PICO_DEFAULT_LED_PIN);
     gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
     gpio_put(PICO_DEFAULT_LED_PIN, 0);
-    flash_init();
+    boot_mark("start", NULL);
 
+    // The FTL is started by the first mount (disk_initialize) or by usb_mode(), so the CPC is
+    // let go at once. Its first ROM access latches a falling edge on ROMEN in the raw
+    // interrupt status, however short, with no interrupt handler on a pin that toggles at MHz
+    gpio_acknowledge_irq(ROMEN_GPIO, GPIO_IRQ_EDGE_FALL);
     CPC_RELEASE_RESET();
 
-    while (to_ms_since_boot(get_absolute_time()) < 500) {
-        // if ROMEN goes low, start emulation
-        if (gpio_get(ROMEN_GPIO) == 0) {
+    while (to_ms_since_boot(get_absolute_time()) < DETECT_WINDOW_MS) {
+        if (romen_edge()) {
+            boot_mark("detect CPC", NULL);
             cpc_mode();
         }
     }
     // If we get here assume that we are not plugged in to a CPC - emuulate a USB drive
+    boot_mark("detect USB", NULL);
     usb_mode();
 }
 
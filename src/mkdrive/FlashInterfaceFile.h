@@ -0,0 +1,93 @@
+/*
+    FlashInterfaceFile.h - Flash interface over an in memory image, for host tools
+
+    Behaves like NOR flash: erase sets a block to 0xff, programming can only clear bits.
+    The image is loaded from and saved to a plain file of the drive region.
+*/
+
+#pragma once
+
+#include "FlashInterface.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+class FlashInterfaceFile : public FlashInterface {
+public:
+    FlashInterfaceFile(int flashSize) : _flash(flashSize, 0xff) {
+    }
+
+    virtual ~FlashInterfaceFile() override {
+    }
+
+    virtual int size() override {
+        return _flash.size();
+    }
+
+    virtual int writeBufferSize() override {
+        // same as the RP2040 so the FTL lays the image out identically
+        return 256;
+    }
+
+    virtual const uint8_t *readEB(int eb) override {
+        return &_flash[eb * ebBytes];
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        if (eb < size() / ebBytes) {
+            memset(&_flash[eb * ebBytes], 0xff, ebBytes);
+            erases++;
+            return true;
+        }
+        return false;
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        if (eb < this->size() / ebBytes) {
+            const uint8_t *src = (const uint8_t *)data;
+            uint8_t *dst = &_flash[eb * ebBytes + offset];
+            for (int i = 0; i < size; i++) {
+                dst[i] &= src[i];
+            }
+            programBytes += size;
+            return true;
+        }
+        return false;
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        if (eb < this->size() / ebBytes) {
+            memcpy(data, &_flash[eb * ebBytes + offset], size);
+            return true;
+        }
+        return false;
+    }
+
+    const std::vector<uint8_t> &image() const {
+        return _flash;
+    }
+
+    bool load(const char *path) {
+        FILE *f = fopen(path, "rb");
+        if (!f) return false;
+        size_t n = fread(_flash.data(), 1, _flash.size(), f);
+        fclose(f);
+        return n == _flash.size();
+    }
+
+    bool save(const char *path) const {
+        FILE *f = fopen(path, "wb");
+        if (!f) return false;
+        size_t n = fwrite(_flash.data(), 1, _flash.size(), f);
+        return fclose(f) == 0 && n == _flash.size();
+    }
+
+    // as FlashInterfaceRP2040_SDK, what the FTL erased and programmed, for write amplification
+    uint32_t erases = 0;
+    uint64_t programBytes = 0;
+
+private:
+    const int ebBytes = 4096;
+    std::vector<uint8_t> _flash;
+};
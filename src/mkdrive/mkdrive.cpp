@@ -0,0 +1,546 @@
+// mkdrive - build a PicoROM drive image on the PC
+// Formats a drive the same way the firmware does, copies ROMs and romsets into it and writes
+// a UF2 of the drive region. With -f the firmware UF2 is merged in, so a board is provisioned
+// with a single copy to the RP2040 boot drive instead of a format and a USB copy. With -F the
+// drive is placed after the firmware and fills the flash chip, as a format on the board would.
+//
+// Uses the firmware's FatFs configuration and SPIFTL over an in memory flash image, so the
+// result is byte for byte what the firmware would have produced.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+extern "C" {
+#include "ff.h"
+#include "diskio.h"
+#include "../picorom.h"
+#include "../sectorcache.h"
+#include "../drivemap.h"
+}
+#include "FlashInterfaceFile.h"
+#include <SPIFTL.h>
+
+// the layout of older firmware, which needs no header
+#define DRIVE_START DRIVEMAP_LEGACY_START
+#define DRIVE_LEN   DRIVEMAP_LEGACY_LEN
+
+#define UF2_MAGIC_START0 0x0A324655
+#define UF2_MAGIC_START1 0x9E5D5157
+#define UF2_MAGIC_END    0x0AB16F30
+#define UF2_FLAG_FAMILY_ID_PRESENT 0x00002000
+#define UF2_FAMILY_RP2040 0xe48bff56
+#define UF2_PAGE_SIZE 256
+#define XIP_START 0x10000000
+
+typedef struct {
+    uint32_t magic_start0;
+    uint32_t magic_start1;
+    uint32_t flags;
+    uint32_t target_addr;
+    uint32_t payload_size;
+    uint32_t block_no;
+    uint32_t num_blocks;
+    uint32_t file_size; // family ID when UF2_FLAG_FAMILY_ID_PRESENT
+    uint8_t data[476];
+    uint32_t magic_end;
+} uf2_block_t;
+
+static_assert(sizeof(uf2_block_t) == 512, "UF2 blocks are 512 bytes");
+
+static FlashInterfaceFile *fi;
+static SPIFTL *ftl;
+static FATFS filesystem;
+static uint8_t work_buf[FF_MAX_SS];
+static int verbose;
+static bool use_cache;      // sectorcache.c in front of the FTL, as flash.cpp
+static uint32_t ftl_reads;
+static uint32_t meta_reads;     // boot sector, FATs and root directory, as disk_meta_reads
+static uint32_t sector_size = DRIVE_SECTOR_SIZE;
+static uint64_t bytes_written;
+
+// FTL sectors in each drive sector
+static uint32_t ftl_per_sector(void) {
+    return sector_size / ftl->lbaBytes;
+}
+
+// FatFs disk functions, as fatfs_driver.c and flash.cpp but straight onto the FTL
+extern "C" {
+
+DSTATUS disk_status(BYTE drv) {
+    return RES_OK;
+}
+
+DSTATUS disk_initialize(BYTE drv) {
+    return RES_OK;
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buff, LBA_t sector, UINT count) {
+    if (sector + count > (LBA_t)(ftl->lbaCount() / ftl_per_sector())) {
+        return RES_ERROR;
+    }
+    if (sector < filesystem.database) {
+        meta_reads += std::min<LBA_t>(count, filesystem.database - sector);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        BYTE *p = buff + i * sector_size;
+        if (use_cache && sectorcache_read(sector + i, p)) continue;
+        for (uint32_t j = 0; j < ftl_per_sector(); j++) {
+            ftl_reads++;
+            if (!ftl->read((sector + i) * ftl_per_sector() + j, p + j * ftl->lbaBytes)) return RES_ERROR;
+        }
+        if (use_cache) sectorcache_fill(sector + i, p);
+    }
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, LBA_t sector, UINT count) {
+    if (sector + count > (LBA_t)(ftl->lbaCount() / ftl_per_sector())) {
+        return RES_ERROR;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        const BYTE *p = buff + i * sector_size;
+        for (uint32_t j = 0; j < ftl_per_sector(); j++) {
+            if (!ftl->write((sector + i) * ftl_per_sector() + j, p + j * ftl->lbaBytes)) return RES_ERROR;
+        }
+        if (use_cache) sectorcache_fill(sector + i, p);
+        bytes_written += sector_size;
+    }
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff) {
+    if (ctrl == GET_SECTOR_COUNT) {
+        *(LBA_t *)buff = ftl->lbaCount() / ftl_per_sector();
+        return RES_OK;
+    }
+    if (ctrl == GET_BLOCK_SIZE) {
+        *(DWORD *)buff = DRIVE_ERASE_BLOCK / sector_size;
+        return RES_OK;
+    }
+    if (ctrl == CTRL_SYNC) {
+        ftl->persist();
+        return RES_OK;
+    }
+    if (ctrl == GET_SECTOR_SIZE) {
+        *(WORD *)buff = sector_size;
+        return RES_OK;
+    }
+    if (ctrl == CTRL_TRIM) {
+        LBA_t *lba = (LBA_t *)buff;
+        for (LBA_t i = lba[0]; i < lba[1]; i++) {
+            sectorcache_trim(i);
+            for (uint32_t j = 0; j < ftl_per_sector(); j++) {
+                ftl->trim(i * ftl_per_sector() + j);
+            }
+        }
+        return RES_OK;
+    }
+    return RES_PARERR;
+}
+
+DWORD get_fattime(void) {
+    return 0;
+}
+
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: mkdrive [options] output.uf2 [file|directory ...]\n"
+        "  Files are copied to the root of the drive, directories have their contents\n"
+        "  copied with their subdirectories.\n"
+        "  -f firmware.uf2  merge a firmware UF2 into the output\n"
+        "  -i image.bin     start from an existing raw drive image instead of formatting\n"
+        "  -r image.bin     also save the raw drive image\n"
+        "  -F bytes         flash size, place the drive after the -f firmware up to the\n"
+        "                   end of the flash as the firmware does\n"
+        "  -s address       drive start (default 0x%08x)\n"
+        "  -l bytes         drive length (default %u)\n"
+        "  -S bytes         sector size, 512 or 4096 for the 4k firmware (default %u)\n"
+        "  -v               list files as they are copied\n"
+        "  -b               benchmark mounting and listing the drive with and without\n"
+        "                   the firmware's sector cache, and loading the ROMs on it\n",
+        DRIVE_START, DRIVE_LEN, DRIVE_SECTOR_SIZE);
+    exit(1);
+}
+
+static void fail(const char *what, const char *path, FRESULT res) {
+    fprintf(stderr, "mkdrive: %s %s failed (FatFs error %d)\n", what, path, res);
+    exit(1);
+}
+
+// as format() in main.c
+static void format(void) {
+    FRESULT res;
+    FIL fp;
+    MKFS_PARM params = {
+        FM_FAT,
+        1,
+        0,
+        0,
+        (DWORD)(sector_size == DRIVE_ERASE_BLOCK ? DRIVE_ERASE_BLOCK : 0)  // as DRIVE_CLUSTER_SIZE
+    };
+    if (!ftl->format() || !ftl->start()) {
+        fprintf(stderr, "mkdrive: FTL format failed\n");
+        exit(1);
+    }
+    res = f_mkfs("", &params, work_buf, sizeof(work_buf));
+    if (res) fail("format", "drive", res);
+    res = f_mount(&filesystem, "", 1);
+    if (res) fail("mount", "drive", res);
+    f_setlabel("PICOROM");
+    f_open(&fp, "README.TXT", FA_CREATE_ALWAYS|FA_WRITE);
+    f_printf(&fp, "Welcome to PICOROM %d.%d.%d\n", VER_MAJOR, VER_MINOR, VER_PATCH);
+    f_printf(&fp, "Copy your ROMs and config files here.\n");
+    f_close(&fp);
+}
+
+static void copy_file(const char *src, const std::string &dest) {
+    FILE *in = fopen(src, "rb");
+    FIL fp;
+    FRESULT res;
+    UINT bw;
+    size_t n;
+
+    if (!in) {
+        perror(src);
+        exit(1);
+    }
+    if (verbose) printf("%s -> %s\n", src, dest.c_str());
+    res = f_open(&fp, dest.c_str(), FA_CREATE_ALWAYS|FA_WRITE);
+    if (res) fail("create", dest.c_str(), res);
+    while ((n = fread(work_buf, 1, sizeof(work_buf), in)) > 0) {
+        res = f_write(&fp, work_buf, n, &bw);
+        if (res) fail("write", dest.c_str(), res);
+        if (bw != n) {
+            fprintf(stderr, "mkdrive: drive full writing %s\n", dest.c_str());
+            exit(1);
+        }
+    }
+    fclose(in);
+    res = f_close(&fp);
+    if (res) fail("close", dest.c_str(), res);
+}
+
+// nftw() callback copying everything below the directory being walked, skipping hidden files
+// and directories. <dirent.h> can't be used as FatFs has its own DIR
+static size_t walk_root;
+
+static int copy_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    if (ftw->level == 0) return 0;
+    std::string dest = path + walk_root + 1;
+    if (dest[0] == '.' || dest.find("/.") != std::string::npos) return 0;
+    if (type == FTW_D) {
+        FRESULT res = f_mkdir(dest.c_str());
+        if (res && res != FR_EXIST) fail("mkdir", dest.c_str(), res);
+    } else if (type == FTW_F) {
+        copy_file(path, dest);
+    }
+    return 0;
+}
+
+static void copy_path(const char *src) {
+    struct stat st;
+    if (stat(src, &st) != 0) {
+        perror(src);
+        exit(1);
+    }
+    if (S_ISDIR(st.st_mode)) {
+        walk_root = strlen(src);
+        while (walk_root > 1 && src[walk_root - 1] == '/') walk_root--;
+        if (nftw(src, copy_entry, 16, 0) != 0) {
+            perror(src);
+            exit(1);
+        }
+    } else {
+        const char *name = strrchr(src, '/');
+        copy_file(src, name ? name + 1 : src);
+    }
+}
+
+// every directory on the drive, as a host does when it is plugged in
+static int list_tree(const char *path) {
+    DIR dir;
+    FILINFO fno;
+    int entries = 0;
+    if (f_opendir(&dir, path) != FR_OK) return 0;
+    while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+        entries++;
+        if (fno.fattrib & AM_DIR) {
+            std::string sub = std::string(path) + "/" + fno.fname;
+            entries += list_tree(sub.c_str());
+        }
+    }
+    f_closedir(&dir);
+    return entries;
+}
+
+// every file that could be a ROM image, with or without an AMSDOS header
+static void find_roms(const char *path, std::vector<std::string> &roms) {
+    DIR dir;
+    FILINFO fno;
+    if (f_opendir(&dir, path) != FR_OK) return;
+    while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+        std::string sub = std::string(path) + "/" + fno.fname;
+        if (fno.fattrib & AM_DIR) {
+            find_roms(sub.c_str(), roms);
+        } else if (fno.fsize > 128 && fno.fsize <= ROM_SIZE + 128) {
+            roms.push_back(sub);
+        }
+    }
+    f_closedir(&dir);
+}
+
+// as load_rom() in main.c, and as it was before it used a fast seek link map and dropped the
+// f_stat() in front of the f_open()
+static void load(const char *path, bool fastseek) {
+    static uint8_t rom[ROM_SIZE];
+    DWORD clmt[2 + 8 * 2];
+    FILINFO fno;
+    FIL fp;
+    UINT br;
+    if (!fastseek && f_stat(path, &fno) != FR_OK) return;
+    if (f_open(&fp, path, FA_READ) != FR_OK) return;
+    if (fastseek) {
+        clmt[0] = sizeof(clmt) / sizeof(clmt[0]);
+        fp.cltbl = clmt;
+        if (f_lseek(&fp, CREATE_LINKMAP) != FR_OK) fp.cltbl = NULL;
+    }
+    f_read(&fp, rom, 128, &br);
+    if (br == 128 && amsdos_header_valid(rom)) {
+        f_read(&fp, rom, std::min<UINT>(((amsdos_header_t *)rom)->logical_length, ROM_SIZE), &br);
+    } else {
+        f_rewind(&fp);
+        f_read(&fp, rom, ROM_SIZE, &br);
+    }
+    f_close(&fp);
+}
+
+// FAT and root directory reads per ROM load, from a fresh mount, without the sector cache
+static void load_benchmark(void) {
+    std::vector<std::string> roms;
+    find_roms("", roms);
+    if (roms.empty()) return;
+    for (int fastseek = 0; fastseek < 2; fastseek++) {
+        f_unmount("");
+        f_mount(&filesystem, "", 1);
+        ftl_reads = meta_reads = 0;
+        for (size_t i = 0; i < roms.size(); i++) {
+            load(roms[i].c_str(), fastseek);
+        }
+        printf("%-9s %u ROM loads, %.1f FAT and root directory reads and %.1f FTL reads per load\n",
+            fastseek ? "fastseek:" : "FAT walk:", (unsigned)roms.size(),
+            (double)meta_reads / roms.size(), (double)ftl_reads / roms.size());
+    }
+}
+
+// FTL reads and time per mount and listing, with the cache cold on the first one as after a
+// plug in and warm after that. The cache is built for DRIVE_SECTOR_SIZE sectors only
+static void benchmark(void) {
+    const int mounts = 10;
+    int passes = sector_size == SECTOR_CACHE_SECTOR ? 2 : 1;
+    for (int cached = 0; cached < passes; cached++) {
+        struct timespec t0, t1;
+        int entries = 0;
+        f_unmount("");
+        use_cache = cached;
+        sectorcache_clear();
+        ftl_reads = 0;
+        sectorcache_hits = sectorcache_misses = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < mounts; i++) {
+            FRESULT res = f_mount(&filesystem, "", 1);
+            if (res) fail("mount", "drive", res);
+            entries = list_tree("");
+            f_unmount("");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double us = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e3 / mounts;
+        printf("%-9s %d entries, %u FTL reads and %.0f us per mount and listing",
+            cached ? "cache:" : "no cache:", entries, ftl_reads / mounts, us);
+        if (cached) printf(", %u hits %u misses", sectorcache_hits, sectorcache_misses);
+        printf("\n");
+    }
+    use_cache = false;
+    f_mount(&filesystem, "", 1);
+}
+
+static std::vector<uf2_block_t> read_uf2(const char *path, uint32_t *end) {
+    std::vector<uf2_block_t> blocks;
+    uf2_block_t b;
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    while (fread(&b, sizeof(b), 1, f) == 1) {
+        if (b.magic_start0 != UF2_MAGIC_START0 || b.magic_start1 != UF2_MAGIC_START1 || b.magic_end != UF2_MAGIC_END) {
+            fprintf(stderr, "mkdrive: %s is not a UF2 file\n", path);
+            exit(1);
+        }
+        if (b.target_addr + b.payload_size > *end) *end = b.target_addr + b.payload_size;
+        blocks.push_back(b);
+    }
+    fclose(f);
+    return blocks;
+}
+
+static uf2_block_t page_block(uint32_t addr, const uint8_t *data) {
+    uf2_block_t b;
+    memset(&b, 0, sizeof(b));
+    b.magic_start0 = UF2_MAGIC_START0;
+    b.magic_start1 = UF2_MAGIC_START1;
+    b.flags = UF2_FLAG_FAMILY_ID_PRESENT;
+    b.target_addr = addr;
+    b.payload_size = UF2_PAGE_SIZE;
+    b.file_size = UF2_FAMILY_RP2040;
+    memcpy(b.data, data, UF2_PAGE_SIZE);
+    b.magic_end = UF2_MAGIC_END;
+    return b;
+}
+
+// Every page is written, including erased ones, so nothing left from an older drive survives.
+// Anywhere but the old fixed place the drive gets a header, see drivemap.c
+static void drive_to_uf2(uint32_t start, std::vector<uf2_block_t> &blocks) {
+    const std::vector<uint8_t> &image = fi->image();
+    if (start != DRIVE_START || image.size() != DRIVE_LEN) {
+        drivemap_t map = {DRIVEMAP_MAGIC, DRIVEMAP_VERSION, start, (uint32_t)image.size(), 0};
+        uint8_t page[UF2_PAGE_SIZE];
+        map.check = drivemap_check(&map);
+        memset(page, 0xff, sizeof(page));
+        memcpy(page, &map, sizeof(map));
+        blocks.push_back(page_block(start - DRIVEMAP_BLOCK, page));
+    }
+    for (size_t offset = 0; offset < image.size(); offset += UF2_PAGE_SIZE) {
+        blocks.push_back(page_block(start + offset, &image[offset]));
+    }
+}
+
+static void write_uf2(const char *path, std::vector<uf2_block_t> &blocks) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].block_no = i;
+        blocks[i].num_blocks = blocks.size();
+    }
+    if (fwrite(blocks.data(), sizeof(uf2_block_t), blocks.size(), f) != blocks.size() || fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *firmware = NULL;
+    const char *image_in = NULL;
+    const char *image_out = NULL;
+    uint32_t start = DRIVE_START;
+    uint32_t len = DRIVE_LEN;
+    uint32_t flash_size = 0;
+    uint32_t firmware_end = 0;
+    std::vector<uf2_block_t> blocks;
+    FRESULT res;
+    DWORD free_clusters;
+    FATFS *fs;
+    int opt;
+    bool bench = false;
+
+    while ((opt = getopt(argc, argv, "f:F:i:r:s:l:S:vb")) != -1) {
+        switch (opt) {
+            case 'f': firmware = optarg; break;
+            case 'F': flash_size = strtoul(optarg, NULL, 0); break;
+            case 'i': image_in = optarg; break;
+            case 'r': image_out = optarg; break;
+            case 's': start = strtoul(optarg, NULL, 0); break;
+            case 'l': len = strtoul(optarg, NULL, 0); break;
+            case 'S': sector_size = strtoul(optarg, NULL, 0); break;
+            case 'v': verbose = 1; break;
+            case 'b': bench = true; break;
+            default: usage();
+        }
+    }
+    if (optind >= argc) usage();
+    if (sector_size != 512 && sector_size != DRIVE_ERASE_BLOCK) usage();
+    if (firmware) blocks = read_uf2(firmware, &firmware_end);
+    if (flash_size) {
+        drivemap_t map;
+        if (!firmware) {
+            fprintf(stderr, "mkdrive: -F places the drive after the firmware, so needs -f\n");
+            exit(1);
+        }
+        drivemap_layout(&map, firmware_end, XIP_START + flash_size);
+        start = map.start;
+        len = map.length;
+        printf("drive at 0x%08x, %u bytes\n", start, len);
+    }
+    if (start % 4096 || len % 4096 || len == 0) {
+        fprintf(stderr, "mkdrive: drive start and length must be multiples of 4096\n");
+        exit(1);
+    }
+    // and the header block in front of a drive that needs one
+    uint32_t drive_first = start != DRIVE_START || len != DRIVE_LEN ? start - DRIVEMAP_BLOCK : start;
+    if (firmware_end > drive_first) {
+        fprintf(stderr, "mkdrive: %s overlaps the drive at 0x%08x\n", firmware, drive_first);
+        exit(1);
+    }
+
+    fi = new FlashInterfaceFile(len);
+    ftl = new SPIFTL(fi);
+    if (image_in) {
+        if (!fi->load(image_in)) {
+            fprintf(stderr, "mkdrive: %s is not a %u byte drive image\n", image_in, len);
+            exit(1);
+        }
+        if (!ftl->start()) {
+            fprintf(stderr, "mkdrive: %s has no FTL\n", image_in);
+            exit(1);
+        }
+        res = f_mount(&filesystem, "", 1);
+        if (res) fail("mount", image_in, res);
+    } else {
+        format();
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = optind + 1; i < argc; i++) {
+        copy_path(argv[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (bench) {
+        benchmark();
+        load_benchmark();
+    }
+    if (f_getfree("", &free_clusters, &fs) == FR_OK) {
+        printf("%lu bytes free\n", (unsigned long)free_clusters * fs->csize * fs->ssize);
+    }
+    f_unmount("");
+    ftl->persist();
+    if (bench) {
+        // the flash model counts what SPIFTL programs and erases, against what FatFs wrote
+        double ms = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e6;
+        printf("%u byte sectors: %llu bytes written in %.1f ms, %llu programmed, %u erases, write amplification %.2f\n",
+            sector_size, (unsigned long long)bytes_written, ms, (unsigned long long)fi->programBytes, fi->erases,
+            bytes_written ? (double)fi->programBytes / bytes_written : 0.0);
+    }
+
+    if (image_out && !fi->save(image_out)) {
+        perror(image_out);
+        exit(1);
+    }
+    drive_to_uf2(start, blocks);
+    write_uf2(argv[optind], blocks);
+    printf("%s: %u blocks\n", argv[optind], (unsigned)blocks.size());
+    return 0;
+}
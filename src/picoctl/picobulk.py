@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# picobulk - send ROMs to PicoROM over its vendor bulk interface
+# Faster than picoctl.py load, the data goes straight into RAM without the command handler.
+# Needs pyusb (and libusb). The CPC is restarted with the new ROM once it is in.
+#
+#   picobulk.py load 7 build/my.rom     send a ROM into bank 7, lower for the lower ROM
+#   picobulk.py loopback [bytes] [count]
+#                                       throughput test, the Pico sends the data back
+import argparse
+import struct
+import sys
+import threading
+import time
+import zlib
+import usb.core
+import usb.util
+
+USB_VID = 0xcafe
+USB_PID = 0x4013    # CDC + MSC + vendor, see usb_descriptors.c
+
+OP_LOAD = 1
+OP_LOOPBACK = 2
+
+STATUS_TEXT = ["OK", "Invalid bank or length", "CRC mismatch", "Timeout", "Shadow bank was loaded during the transfer"]
+
+ROM_SIZE = 16384
+LOWER_ROM = 0xff
+
+
+class PicoBulk:
+    def __init__(self):
+        dev = usb.core.find(idVendor=USB_VID, idProduct=USB_PID)
+        if dev is None:
+            raise IOError("PicoROM not found")
+        cfg = dev.get_active_configuration()
+        itf = usb.util.find_descriptor(cfg, bInterfaceClass=0xff)
+        if itf is None:
+            raise IOError("PicoROM has no bulk interface, update the firmware")
+        if dev.is_kernel_driver_active(itf.bInterfaceNumber):
+            dev.detach_kernel_driver(itf.bInterfaceNumber)
+        usb.util.claim_interface(dev, itf.bInterfaceNumber)
+        self.ep_out = usb.util.find_descriptor(itf, custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+        self.ep_in = usb.util.find_descriptor(itf, custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+
+    def send(self, op, bank, data):
+        self.ep_out.write(struct.pack("<2sBBII", b"PB", op, bank, len(data), zlib.crc32(data)) + data, timeout=5000)
+
+    def reply(self, r=None):
+        if r is None:
+            r = bytes(self.ep_in.read(64, timeout=5000))
+        magic, op, status, crc = struct.unpack("<2sBBI", r)
+        if magic != b"PB":
+            raise IOError("bad reply from PicoROM")
+        return status, crc
+
+    def load(self, bank, data):
+        self.send(OP_LOAD, bank, data)
+        return self.reply()
+
+    def loopback(self, data):
+        # The Pico only buffers a packet, so the echo is read while the data is sent. The reply
+        # can share a packet with the end of the echo
+        received = bytearray()
+
+        def reader():
+            while len(received) < len(data) + 8:
+                received.extend(self.ep_in.read(4096, timeout=5000))
+
+        thread = threading.Thread(target=reader)
+        thread.start()
+        self.send(OP_LOOPBACK, 0, data)
+        thread.join()
+        status, crc = self.reply(bytes(received[len(data):]))
+        return status, bytes(received[:len(data)])
+
+def main():
+    parser = argparse.ArgumentParser(description="Send ROMs to PicoROM over USB bulk")
+    parser.add_argument("command", choices=["load", "loopback"])
+    parser.add_argument("args", nargs="*")
+    args = parser.parse_args()
+    pico = PicoBulk()
+    a = args.args
+
+    if args.command == "load":
+        bank = LOWER_ROM if a[0] == "lower" else int(a[0])
+        data = open(a[1], "rb").read()
+        if len(data) >= 128 and struct.unpack_from("<H", data, 67)[0] == sum(data[:67]) & 0xffff:
+            data = data[128:128 + struct.unpack_from("<H", data, 24)[0]]   # AMSDOS header
+        data = data[:ROM_SIZE]
+        start = time.time()
+        status, crc = pico.load(bank, data)
+        elapsed = time.time() - start
+        print("%s: %d bytes crc32 %08x %.1f ms" % (STATUS_TEXT[status], len(data), crc, elapsed * 1000))
+        return status
+
+    size = int(a[0]) if a else ROM_SIZE
+    count = int(a[1]) if len(a) > 1 else 64
+    data = bytes(i * 7 & 0xff for i in range(size))
+    start = time.time()
+    for i in range(count):
+        status, echo = pico.loopback(data)
+        if status or echo != data:
+            print("loopback %d failed: %s" % (i, STATUS_TEXT[status] if status else "data mismatch"))
+            return 1
+    elapsed = time.time() - start
+    print("%d x %d bytes each way in %.2f s, %.0f KB/s each way" % (count, size, elapsed, size * count / elapsed / 1024))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# picoctl - run PicoROM commands over USB
+# Sends the same command bytes as picorom.s on the CPC, over the Pico's USB serial port.
+# Needs pyserial. Commands other than led and roms restart the CPC.
+#
+#   picoctl.py [-p /dev/ttyACM0] roms
+#   picoctl.py romin 7 MAXAM.ROM       load a ROM from the drive
+#   picoctl.py romout 7
+#   picoctl.py romset GAMES1.CFG
+#   picoctl.py load 7 build/my.rom     send a ROM from the PC, lower for the lower ROM
+#   picoctl.py dir /ROMS
+#   picoctl.py led 1
+#   picoctl.py boot                    how long each start up phase took
+#   picoctl.py latency [clear]         latency firmware histogram, as |LATENCY
+import argparse
+import sys
+import serial
+
+CMD_PREFIX_BYTE = 0xfc
+CMD_LED = 0xfe
+CMD_ROMDIR1 = 0xfd
+CMD_ROMDIR2 = 0xfc
+CMD_ROMLIST1 = 0xfb
+CMD_ROMLIST2 = 0xfa
+CMD_ROMIN = 0xf9
+CMD_ROMOUT = 0xf8
+CMD_ROMSET = 0xf7
+CMD_ROMFIND1 = 0xf5
+CMD_ROMFIND2 = 0xf4
+CMD_DIR1 = 0xf3
+CMD_DIR2 = 0xf2
+CMD_LATENCY1 = 0xed
+CMD_LATENCY2 = 0xec
+CMD_LATENCY_CLR = 0xeb
+CMD_ROMDATA = 0xe8
+CMD_BOOT1 = 0xe7
+CMD_BOOT2 = 0xe6
+
+ROM_SIZE = 16384
+LOWER_ROM = 0xff
+
+
+class PicoROM:
+    def __init__(self, port):
+        self.port = serial.Serial(port, timeout=10)
+        self.port.reset_input_buffer()
+
+    def command(self, cmd, params=b""):
+        """Run one command, returns (status, text)"""
+        self.port.write(bytes([CMD_PREFIX_BYTE, cmd]) + bytes(params))
+        header = self.port.read(4)
+        if len(header) != 4:
+            raise IOError("no response from PicoROM")
+        data = self.port.read(header[3])
+        return header[1], data.decode("latin-1")
+
+    def listing(self, first, next, params=b""):
+        status, text = self.command(first, params)
+        while status == 0:
+            yield text
+            status, text = self.command(next)
+
+
+def string(s):
+    s = s.encode("latin-1")
+    return bytes([len(s)]) + s
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run PicoROM commands over USB")
+    parser.add_argument("-p", "--port", default="/dev/ttyACM0")
+    parser.add_argument("command", choices=["roms", "romin", "romout", "romset", "load", "romdir", "romfind", "dir", "led", "boot", "latency"])
+    parser.add_argument("args", nargs="*")
+    args = parser.parse_args()
+    pico = PicoROM(args.port)
+    a = args.args
+    status = 0
+
+    if args.command == "roms":
+        for line in pico.listing(CMD_ROMLIST1, CMD_ROMLIST2):
+            print(line)
+    elif args.command == "romdir":
+        for line in pico.listing(CMD_ROMDIR1, CMD_ROMDIR2):
+            print(line)
+    elif args.command == "romfind":
+        for line in pico.listing(CMD_ROMFIND1, CMD_ROMFIND2, string(a[0])):
+            print(line)
+    elif args.command == "dir":
+        path = a[0] if a else ""
+        for line in pico.listing(CMD_DIR1, CMD_DIR2, bytes([0, 0]) + string(path)):
+            print(line)
+    elif args.command == "romin":
+        status, text = pico.command(CMD_ROMIN, bytes([int(a[0])]) + string(a[1]))
+    elif args.command == "romout":
+        status, text = pico.command(CMD_ROMOUT, bytes([int(a[0])]))
+    elif args.command == "romset":
+        status, text = pico.command(CMD_ROMSET, string(a[0]))
+    elif args.command == "load":
+        bank = LOWER_ROM if a[0] == "lower" else int(a[0])
+        data = open(a[1], "rb").read()[:ROM_SIZE]
+        status, text = pico.command(CMD_ROMDATA, bytes([bank, len(data) & 0xff, len(data) >> 8]) + data)
+    elif args.command == "boot":
+        for line in pico.listing(CMD_BOOT1, CMD_BOOT2):
+            print(line)
+    elif args.command == "latency" and a and a[0] == "clear":
+        status, text = pico.command(CMD_LATENCY_CLR)
+        print(text)
+    elif args.command == "latency":
+        for line in pico.listing(CMD_LATENCY1, CMD_LATENCY2):
+            print(line)
+    elif args.command == "led":
+        status, text = pico.command(CMD_LED, bytes([int(a[0])]))
+    if args.command in ("romin", "romout", "romset", "load", "led") and text:
+        print(text)
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
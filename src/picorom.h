@@ -0,0 +1,61 @@
+#ifndef _PICOROM_H_
+#define _PICOROM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define VER_MAJOR 3
+#define VER_MINOR 1
+#define VER_PATCH 1
+
+#define ROM_SIZE 16384
+
+// Sector size of the flash drive seen by FatFs and the USB host. With 4096 each sector is one
+// flash erase block made of DRIVE_SECTOR_SIZE / 512 FTL sectors, and a cluster is one sector
+#ifndef DRIVE_SECTOR_SIZE
+#define DRIVE_SECTOR_SIZE   512
+#endif
+#define DRIVE_ERASE_BLOCK   4096
+#define DRIVE_CLUSTER_SIZE  (DRIVE_SECTOR_SIZE == DRIVE_ERASE_BLOCK ? DRIVE_ERASE_BLOCK : 0) // 0 lets f_mkfs choose
+
+#pragma pack(1)
+typedef struct {
+    uint8_t user_number;
+    char filename[8];
+    char ext[3];
+    char zeros[4];
+    uint8_t block_number;
+    uint8_t last_block;
+    uint8_t file_type;
+    uint16_t data_length;
+    uint16_t data_location;
+    uint8_t first_block;
+    uint16_t logical_length;
+    uint16_t entry_address;
+    char unused[36];
+    uint8_t real_length_h;
+    uint16_t real_length;
+    uint16_t checksum;
+    char unused2[59];
+} amsdos_header_t;
+#pragma pack()
+
+// true if the 128 byte buffer starts with a valid AMSDOS header
+static inline bool amsdos_header_valid(const void *buf) {
+    const amsdos_header_t *hdr = (const amsdos_header_t *)buf;
+    uint16_t chksum = 0;
+    for (int i=0;i<67;i++) {
+        chksum += ((const uint8_t *)buf)[i];
+    }
+    return chksum == hdr->checksum;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void debug(const char *msg);
+void fdebug(const char *fmt, ...);
+#ifdef __cplusplus
+}
+#endif
+#endif
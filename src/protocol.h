@@ -0,0 +1,51 @@
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+// CPC <-> Pico command protocol. Must match the EQUs in z80/picorom.s
+//
+// The CPC writes CMD_PREFIX_BYTE, a command byte, then its parameters to the latch at &DFxx.
+// Fixed parameters are collected by handle_latch(); strings are sent as a length byte followed
+// by the characters. The Pico answers in the response buffer at the top of the currently
+// selected ROM, so it shows up at &FF00, and the CPC polls the sequence number until it changes.
+// List commands come in pairs: the first returns the first item, the second returns the next
+// item until the status is non zero.
+//
+// The same commands can be sent over USB CDC, see usbcmd.c. There every command is answered
+// with <seq> <status> <type> <length> <data>, also those that restart the CPC instead.
+
+#define RESP_BUF        0x3F00  // offset in the selected upper ROM
+#define RESP_SEQ        0       // incremented when the response is ready
+#define RESP_STATUS     1       // 0=OK, list commands use 1 for end of list
+#define RESP_TYPE       2       // 1=null terminated string
+#define RESP_DATA       3
+
+#define CMD_PREFIX_BYTE 0xfc
+
+#define CMD_PICOLOAD    0xff
+#define CMD_LED         0xfe
+#define CMD_ROMDIR1		0xfd
+#define CMD_ROMDIR2		0xfc
+#define CMD_ROMLIST1	0xfb
+#define CMD_ROMLIST2    0xfa
+#define CMD_ROMIN       0xf9
+#define CMD_ROMOUT      0xf8
+#define CMD_ROMSET      0xf7
+#define CMD_PSAVE       0xf6
+#define CMD_ROMFIND1    0xf5
+#define CMD_ROMFIND2    0xf4
+#define CMD_DIR1        0xf3
+#define CMD_DIR2        0xf2
+#define CMD_LOGFLUSH    0xf1
+#define CMD_PROFILE1    0xf0
+#define CMD_PROFILE2    0xef
+#define CMD_PROFILE_CLR 0xee
+#define CMD_LATENCY1    0xed
+#define CMD_LATENCY2    0xec
+#define CMD_LATENCY_CLR 0xeb
+#define CMD_CALIBRATE   0xea
+#define CMD_TRACE       0xe9
+#define CMD_ROMDATA     0xe8    // USB only: <bank> <length lo> <length hi> <data>, bank 0xff = lower ROM
+#define CMD_BOOT1       0xe7
+#define CMD_BOOT2       0xe6
+
+#endif
@@ -0,0 +1,56 @@
+# Write a RAM budget report for a firmware ELF
+# cmake -DELF=<elf> -DNM=<nm> -DSIZE=<size> -DOUT=<report> -P ram_report.cmake
+#
+# Lists every section in SRAM and scratch X/Y, then every symbol in them largest first,
+# so it is easy to see what is using the RAM that is not holding ROMs.
+
+if(NOT DEFINED RAM_START)
+    set(RAM_START 536870912)    # 0x20000000
+endif()
+if(NOT DEFINED RAM_END)
+    set(RAM_END 570425344)      # 0x22000000, includes the non-striped aliases
+endif()
+
+function(pad text width out)
+    string(LENGTH "${text}" len)
+    while(len LESS width)
+        string(APPEND text " ")
+        math(EXPR len "${len} + 1")
+    endwhile()
+    set(${out} "${text}" PARENT_SCOPE)
+endfunction()
+
+execute_process(COMMAND ${SIZE} -A -d ${ELF} OUTPUT_VARIABLE size_out)
+execute_process(COMMAND ${NM} -S -C --size-sort -r --radix=d ${ELF} OUTPUT_VARIABLE nm_out)
+
+pad("section" 24 col)
+set(report "RAM budget for ${ELF}\n\n${col}size  address\n")
+set(total 0)
+string(REPLACE "\n" ";" lines "${size_out}")
+foreach(line ${lines})
+    if(line MATCHES "^([^ ]+) +([0-9]+) +([0-9]+)$")
+        set(bytes ${CMAKE_MATCH_2})
+        set(addr ${CMAKE_MATCH_3})
+        if(bytes GREATER 0 AND addr GREATER_EQUAL RAM_START AND addr LESS RAM_END)
+            pad("${CMAKE_MATCH_1}" 24 col)
+            pad("${bytes}" 6 size_col)
+            math(EXPR hex "${addr}" OUTPUT_FORMAT HEXADECIMAL)
+            string(APPEND report "${col}${size_col}${hex}\n")
+            math(EXPR total "${total} + ${bytes}")
+        endif()
+    endif()
+endforeach()
+pad("total" 24 col)
+string(APPEND report "${col}${total}\n\nsize  type symbol\n")
+
+string(REPLACE "\n" ";" lines "${nm_out}")
+foreach(line ${lines})
+    # nm pads decimal values with zeros
+    if(line MATCHES "^0*([0-9]+) 0*([0-9]+) ([A-Za-z]) (.*)$")
+        if(CMAKE_MATCH_1 GREATER_EQUAL RAM_START AND CMAKE_MATCH_1 LESS RAM_END)
+            pad("${CMAKE_MATCH_2}" 6 size_col)
+            string(APPEND report "${size_col}${CMAKE_MATCH_3}     ${CMAKE_MATCH_4}\n")
+        endif()
+    endif()
+endforeach()
+file(WRITE ${OUT} "${report}")
@@ -0,0 +1,67 @@
+// CRC32 of ROM images using the DMA sniffer
+// A DMA channel reads the image a byte at a time into a dummy word and the sniffer
+// accumulates the CRC, so the CPU is free. The sniffer runs in bit reversed CRC32 mode with
+// the result reversed and inverted on read, which matches the zlib CRC32 in romindex.c.
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "romcrc.h"
+
+static int crc_chan = -1;
+static uint32_t dummy;
+static bool running;    // a background CRC has been started and not collected
+
+void romcrc_init(void) {
+    crc_chan = dma_claim_unused_channel(true);
+}
+
+static void start(const uint8_t *data, uint32_t len, bool reset) {
+    dma_channel_config c = dma_channel_get_default_config(crc_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_sniff_enable(&c, true);
+    if (reset) {
+        dma_sniffer_enable(crc_chan, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+        hw_set_bits(&dma_hw->sniff_ctrl, DMA_SNIFF_CTRL_OUT_REV_BITS | DMA_SNIFF_CTRL_OUT_INV_BITS);
+        dma_hw->sniff_data = 0xffffffff;
+    }
+    dma_channel_configure(crc_chan, &c, &dummy, data, len, true);
+}
+
+uint32_t romcrc_compute(const uint8_t *data, uint32_t len, uint32_t split, uint32_t *first) {
+    romcrc_abort();
+    if (split > len) split = len;
+    start(data, split, true);
+    dma_channel_wait_for_finish_blocking(crc_chan);
+    *first = dma_hw->sniff_data;
+    if (len > split) {
+        // carry on from the same accumulator
+        start(data + split, len - split, false);
+        dma_channel_wait_for_finish_blocking(crc_chan);
+    }
+    return dma_hw->sniff_data;
+}
+
+void romcrc_start(const uint8_t *data, uint32_t len) {
+    romcrc_abort();
+    start(data, len, true);
+    running = true;
+}
+
+bool romcrc_busy(void) {
+    return running;
+}
+
+bool romcrc_done(uint32_t *crc) {
+    if (!running || dma_channel_is_busy(crc_chan)) return false;
+    running = false;
+    *crc = dma_hw->sniff_data;
+    return true;
+}
+
+void romcrc_abort(void) {
+    if (running) {
+        dma_channel_abort(crc_chan);
+        running = false;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef _ROMCRC_H_
+#define _ROMCRC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// CRC32 (zlib, same as crc32_update) of RAM using the DMA sniffer
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void romcrc_init(void);
+// CRC of len bytes, and of the first split bytes in *first. Blocks until done
+uint32_t romcrc_compute(const uint8_t *data, uint32_t len, uint32_t split, uint32_t *first);
+// background CRC of len bytes, poll with romcrc_done()
+void romcrc_start(const uint8_t *data, uint32_t len);
+bool romcrc_busy(void);
+bool romcrc_done(uint32_t *crc);
+void romcrc_abort(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
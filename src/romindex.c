@@ -0,0 +1,261 @@
+// Persistent ROM metadata index
+// ROMINDEX.DAT holds a header followed by one fixed size entry per ROM file on the drive.
+// The index is rebuilt incrementally: files whose size and timestamp are unchanged keep
+// their old entry, only new or modified files are read and CRC'd.
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <ff.h>
+#include "picorom.h"
+#include "romindex.h"
+
+static bool stale = true;   // rebuild before next use
+static FIL index_fp;        // new index while refreshing, then used for listing
+static FIL fp;              // old index and ROM files while refreshing
+static FILINFO fno;
+static uint32_t old_count;  // entries in the old index
+static uint32_t old_cursor; // next old entry to try, files are usually found in the same order
+static bool old_open;
+static char find_filter[64];
+
+static const uint32_t crc32_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+// standard (zlib) CRC32. Pass 0 to start
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc = crc32_table[(crc ^ *data) & 0x0f] ^ (crc >> 4);
+        crc = crc32_table[(crc ^ (*data >> 4)) & 0x0f] ^ (crc >> 4);
+        data++;
+    }
+    return ~crc;
+}
+
+void romindex_invalidate(void) {
+    stale = true;
+}
+
+static bool is_rom_file(const char *name) {
+    const char *ext = strrchr(name, '.');
+    return ext && strcasecmp(ext, ".ROM") == 0;
+}
+
+// case insensitive strstr
+static bool contains(const char *s, const char *text) {
+    size_t l = strlen(text);
+    for (;*s;s++) {
+        if (strncasecmp(s, text, l) == 0) return true;
+    }
+    return l == 0;
+}
+
+static bool read_header(FIL *f, romindex_header_t *hdr) {
+    UINT br;
+    if (f_read(f, hdr, sizeof(*hdr), &br) != FR_OK || br != sizeof(*hdr)) return false;
+    return hdr->magic == ROMINDEX_MAGIC && hdr->version == ROMINDEX_VERSION && hdr->entry_size == sizeof(romindex_entry_t);
+}
+
+// Read a ROM file the same way load_rom() does and fill in its metadata
+static bool scan_rom(const char *path, romindex_entry_t *entry) {
+    uint8_t buf[256];
+    UINT br;
+    FSIZE_t offset = 0;
+    uint32_t length = ROM_SIZE;
+    uint32_t done = 0;
+    uint16_t name_table = 0;
+
+    if (f_open(&fp, path, FA_READ) != FR_OK) return false;
+    if (f_read(&fp, buf, 128, &br) != FR_OK) {
+        f_close(&fp);
+        return false;
+    }
+    if (br == 128 && amsdos_header_valid(buf)) {
+        entry->flags |= ROMINDEX_HAS_HEADER;
+        offset = 128;
+        length = ((amsdos_header_t *)buf)->logical_length;
+    }
+    if (length > entry->size - offset) length = entry->size - offset;
+    if (length > ROM_SIZE) length = ROM_SIZE;
+    entry->length = length;
+    f_lseek(&fp, offset);
+    while (done < length) {
+        UINT btr = (length - done < sizeof(buf)) ? length - done : sizeof(buf);
+        if (f_read(&fp, buf, btr, &br) != FR_OK || br == 0) break;
+        if (done == 0 && br >= 6) {
+            entry->type = buf[0];
+            entry->major = buf[1];
+            entry->minor = buf[2];
+            entry->patch = buf[3];
+            name_table = buf[4] | (buf[5] << 8);
+        }
+        entry->crc32 = crc32_update(entry->crc32, buf, br);
+        done += br;
+    }
+    // first RSX name
+    if ((entry->type < 2 || entry->type == 0x80) && name_table >= 0xc000 && (uint32_t)(name_table - 0xc000) < length) {
+        f_lseek(&fp, offset + name_table - 0xc000);
+        if (f_read(&fp, buf, sizeof(entry->rsx), &br) == FR_OK) {
+            for (UINT i=0;i<br;i++) {
+                entry->rsx[i] = buf[i] & 0x7f;
+                if (buf[i] & 0x80) break;
+            }
+        }
+    }
+    f_close(&fp);
+    return true;
+}
+
+// look for path in the old index
+static bool find_old(const char *path, romindex_entry_t *entry) {
+    UINT br;
+    if (old_count == 0) return false;
+    if (!old_open) {
+        if (f_open(&fp, ROMINDEX_FILE, FA_READ) != FR_OK) {
+            old_count = 0;
+            return false;
+        }
+        old_open = true;
+    }
+    for (uint32_t n=0;n<old_count;n++) {
+        uint32_t i = (old_cursor + n) % old_count;
+        f_lseek(&fp, sizeof(romindex_header_t) + i * sizeof(romindex_entry_t));
+        if (f_read(&fp, entry, sizeof(*entry), &br) != FR_OK || br != sizeof(*entry)) return false;
+        if (strcmp(entry->path, path) == 0) {
+            old_cursor = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// add the file described by fno to the new index
+static void add_entry(const char *path, uint32_t *count) {
+    romindex_entry_t entry;
+    UINT bw;
+    if (!find_old(path, &entry) || entry.size != fno.fsize || entry.fdate != fno.fdate || entry.ftime != fno.ftime) {
+        memset(&entry, 0, sizeof(entry));
+        strcpy(entry.path, path);
+        entry.size = fno.fsize;
+        entry.fdate = fno.fdate;
+        entry.ftime = fno.ftime;
+        if (old_open) {
+            f_close(&fp);
+            old_open = false;
+        }
+        if (!scan_rom(path, &entry)) return;
+        fdebug("Indexed %s crc32 %08x", path, entry.crc32);
+    }
+    if (f_write(&index_fp, &entry, sizeof(entry), &bw) == FR_OK && bw == sizeof(entry)) {
+        (*count)++;
+    }
+}
+
+// walk the directory tree below path, adding every ROM file
+static void index_dir(char *path, int depth, uint32_t *count) {
+    DIR dir;
+    size_t len = strlen(path);
+    if (f_opendir(&dir, len ? path : "/") != FR_OK) return;
+    while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+        if (fno.fattrib & (AM_HID|AM_SYS)) continue;
+        if (len + strlen(fno.fname) + 2 > sizeof(((romindex_entry_t *)0)->path)) continue;
+        sprintf(path + len, len ? "/%s" : "%s", fno.fname);
+        if (fno.fattrib & AM_DIR) {
+            if (depth < ROMINDEX_MAX_DEPTH) index_dir(path, depth + 1, count);
+        } else if (is_rom_file(fno.fname)) {
+            add_entry(path, count);
+        }
+        path[len] = 0;
+    }
+    f_closedir(&dir);
+}
+
+// Bring ROMINDEX.DAT up to date if the drive may have changed
+bool romindex_refresh(void) {
+    romindex_header_t hdr = { ROMINDEX_MAGIC, ROMINDEX_VERSION, sizeof(romindex_entry_t), 0 };
+    char path[sizeof(((romindex_entry_t *)0)->path)] = "";
+    UINT bw;
+
+    if (!stale) return true;
+    f_close(&index_fp);
+    old_count = 0;
+    old_cursor = 0;
+    old_open = false;
+    if (f_open(&fp, ROMINDEX_FILE, FA_READ) == FR_OK) {
+        romindex_header_t old;
+        if (read_header(&fp, &old)) old_count = old.count;
+        f_close(&fp);
+    }
+    if (f_open(&index_fp, ROMINDEX_TMP_FILE, FA_CREATE_ALWAYS|FA_WRITE) != FR_OK) return false;
+    f_write(&index_fp, &hdr, sizeof(hdr), &bw);
+    index_dir(path, 0, &hdr.count);
+    if (old_open) {
+        f_close(&fp);
+        old_open = false;
+    }
+    f_lseek(&index_fp, 0);
+    f_write(&index_fp, &hdr, sizeof(hdr), &bw);
+    if (f_close(&index_fp) != FR_OK) return false;
+    f_unlink(ROMINDEX_FILE);
+    if (f_rename(ROMINDEX_TMP_FILE, ROMINDEX_FILE) != FR_OK) return false;
+    fdebug("ROM index: %u ROMs", hdr.count);
+    stale = false;
+    return true;
+}
+
+static bool open_index(void) {
+    romindex_header_t hdr;
+    if (!romindex_refresh()) return false;
+    f_close(&index_fp);
+    if (f_open(&index_fp, ROMINDEX_FILE, FA_READ) != FR_OK) return false;
+    if (!read_header(&index_fp, &hdr)) {
+        f_close(&index_fp);
+        stale = true;
+        return false;
+    }
+    return true;
+}
+
+// Start listing the index. Only entries whose path or RSX name contains filter are returned.
+// filter may be NULL to list everything
+bool romindex_first(const char *filter, romindex_entry_t *entry) {
+    strncpy(find_filter, filter ? filter : "", sizeof(find_filter) - 1);
+    if (!open_index()) return false;
+    return romindex_next(entry);
+}
+
+bool romindex_next(romindex_entry_t *entry) {
+    UINT br;
+    char rsx[sizeof(entry->rsx) + 1];
+    while (f_read(&index_fp, entry, sizeof(*entry), &br) == FR_OK && br == sizeof(*entry)) {
+        memcpy(rsx, entry->rsx, sizeof(entry->rsx));
+        rsx[sizeof(entry->rsx)] = 0;
+        if (contains(entry->path, find_filter) || contains(rsx, find_filter)) return true;
+    }
+    f_close(&index_fp);
+    return false;
+}
+
+// Find path in ROMINDEX.DAT as it is, without bringing it up to date first, so a ROM load
+// never walks the drive. The entry can be older than the file, the caller compares the
+// size and timestamp.
+bool romindex_lookup(const char *path, romindex_entry_t *entry) {
+    FIL f;
+    romindex_header_t hdr;
+    UINT br;
+    bool found = false;
+    if (f_open(&f, ROMINDEX_FILE, FA_READ) != FR_OK) return false;
+    if (read_header(&f, &hdr)) {
+        while (f_read(&f, entry, sizeof(*entry), &br) == FR_OK && br == sizeof(*entry)) {
+            if (strcasecmp(entry->path, path) == 0) {
+                found = true;
+                break;
+            }
+        }
+    }
+    f_close(&f);
+    return found;
+}
@@ -0,0 +1,53 @@
+#ifndef _ROMINDEX_H_
+#define _ROMINDEX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Persistent index of every ROM file on the drive, kept in ROMINDEX.DAT
+#define ROMINDEX_FILE       "ROMINDEX.DAT"
+#define ROMINDEX_TMP_FILE   "ROMINDEX.TMP"
+#define ROMINDEX_MAGIC      0x58444952 // "RIDX"
+#define ROMINDEX_VERSION    1
+#define ROMINDEX_MAX_DEPTH  4
+
+// entry flags
+#define ROMINDEX_HAS_HEADER 0x01 // file has an AMSDOS header
+
+#pragma pack(1)
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint32_t count;
+} romindex_header_t;
+
+typedef struct {
+    char path[64];      // full path, null terminated
+    uint32_t size;      // file size
+    uint32_t crc32;     // CRC32 of the ROM image as loaded (AMSDOS header stripped)
+    uint16_t fdate;     // file date and time, used to spot changed files
+    uint16_t ftime;
+    uint16_t length;    // ROM image length
+    uint8_t flags;
+    uint8_t type;       // ROM header: type and version
+    uint8_t major;
+    uint8_t minor;
+    uint8_t patch;
+    char rsx[16];       // first RSX name, not terminated if 16 chars
+} romindex_entry_t;
+#pragma pack()
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
+void romindex_invalidate(void);
+bool romindex_refresh(void);
+bool romindex_first(const char *filter, romindex_entry_t *entry);
+bool romindex_next(romindex_entry_t *entry);
+bool romindex_lookup(const char *path, romindex_entry_t *entry);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,120 @@
+// Sector cache for the FAT volume's metadata
+// Hosts reread the boot sector, FATs and root directory on every mount and listing, and FatFs
+// rereads FAT sectors following cluster chains. Each of those is a SPIFTL map lookup and a copy
+// out of XIP flash (a slow stream read in the copy_to_ram firmware), so the most recently used
+// ones are kept in RAM. Only sectors up to the end of the root directory are cached, taken from
+// the boot sector as it goes past, so reading a ROM's data can't push them out. The cache is
+// write through: flash_write() fills it as well as writing the sector, trims drop the sector
+// and a new boot sector (a format) empties it.
+#include <string.h>
+#include "sectorcache.h"
+
+uint32_t sectorcache_hits;
+uint32_t sectorcache_misses;
+
+#if SECTOR_CACHE_SECTORS
+
+typedef struct {
+    uint32_t lba;
+    uint32_t used;      // LRU tick
+    bool valid;
+} sectorcache_entry_t;
+
+static sectorcache_entry_t entries[SECTOR_CACHE_SECTORS];
+static uint8_t data[SECTOR_CACHE_SECTORS][SECTOR_CACHE_SECTOR];
+static uint32_t tick;
+static uint32_t volume_start;   // boot sector, after an MBR
+static uint32_t limit;          // first sector after the root directory
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+// work out the metadata area from a boot sector, or where the volume starts from an MBR
+static void parse(uint32_t lba, const uint8_t *p) {
+    bool bpb = (p[0] == 0xeb || p[0] == 0xe9) && get16(p + 11) == SECTOR_CACHE_SECTOR && p[16] != 0;
+    if (bpb) {
+        uint32_t fat_size = get16(p + 22) ? get16(p + 22) : get32(p + 36);
+        volume_start = lba;
+        limit = lba + get16(p + 14) + p[16] * fat_size + (get16(p + 17) * 32 + SECTOR_CACHE_SECTOR - 1) / SECTOR_CACHE_SECTOR;
+    } else if (lba == 0 && get16(p + 510) == 0xaa55 && p[446 + 4] != 0 && get32(p + 446 + 8) != volume_start) {
+        volume_start = get32(p + 446 + 8);
+        limit = 0;  // until its boot sector is seen
+    }
+}
+
+static bool cacheable(uint32_t lba) {
+    return lba <= volume_start || lba < limit;
+}
+
+static sectorcache_entry_t *find(uint32_t lba) {
+    for (int i=0;i<SECTOR_CACHE_SECTORS;i++) {
+        if (entries[i].valid && entries[i].lba == lba) return &entries[i];
+    }
+    return NULL;
+}
+
+bool sectorcache_read(uint32_t lba, uint8_t *buffer) {
+    if (!cacheable(lba)) return false;
+    sectorcache_entry_t *e = find(lba);
+    if (!e) {
+        sectorcache_misses++;
+        return false;
+    }
+    e->used = ++tick;
+    memcpy(buffer, data[e - entries], SECTOR_CACHE_SECTOR);
+    sectorcache_hits++;
+    return true;
+}
+
+void sectorcache_fill(uint32_t lba, const uint8_t *buffer) {
+    if (lba == 0 || lba == volume_start) {
+        uint32_t old_limit = limit;
+        parse(lba, buffer);
+        if (limit != old_limit) sectorcache_clear();
+    }
+    if (!cacheable(lba)) return;
+    sectorcache_entry_t *e = find(lba);
+    if (!e) {
+        e = &entries[0];
+        for (int i=1;i<SECTOR_CACHE_SECTORS && e->valid;i++) {
+            if (!entries[i].valid || entries[i].used < e->used) e = &entries[i];
+        }
+        e->lba = lba;
+        e->valid = true;
+    }
+    e->used = ++tick;
+    memcpy(data[e - entries], buffer, SECTOR_CACHE_SECTOR);
+}
+
+void sectorcache_trim(uint32_t lba) {
+    sectorcache_entry_t *e = find(lba);
+    if (e) e->valid = false;
+}
+
+void sectorcache_clear(void) {
+    for (int i=0;i<SECTOR_CACHE_SECTORS;i++) {
+        entries[i].valid = false;
+    }
+}
+
+#else
+
+bool sectorcache_read(uint32_t lba, uint8_t *buffer) {
+    return false;
+}
+
+void sectorcache_fill(uint32_t lba, const uint8_t *buffer) {
+}
+
+void sectorcache_trim(uint32_t lba) {
+}
+
+void sectorcache_clear(void) {
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _SECTORCACHE_H_
+#define _SECTORCACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "picorom.h"
+
+// LRU cache of the FAT volume's boot sector, FATs and root directory, see sectorcache.c
+#ifndef SECTOR_CACHE_SECTORS
+#define SECTOR_CACHE_SECTORS    (DRIVE_SECTOR_SIZE == 512 ? 8 : 2)  // 0 turns the cache off
+#endif
+#define SECTOR_CACHE_SECTOR     DRIVE_SECTOR_SIZE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// lookups of metadata sectors
+extern uint32_t sectorcache_hits;
+extern uint32_t sectorcache_misses;
+// copy a cached sector to buffer, false if it has to be read
+bool sectorcache_read(uint32_t lba, uint8_t *buffer);
+// a sector has been read from or written to the flash
+void sectorcache_fill(uint32_t lba, const uint8_t *buffer);
+void sectorcache_trim(uint32_t lba);
+void sectorcache_clear(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
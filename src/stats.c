@@ -0,0 +1,50 @@
+// Counter registry for the STATS.TXT, BANKS.TXT and FTL.TXT files on the live drive, see live.c
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+
+typedef struct {
+    const char *name;
+    const volatile uint32_t *value;
+    uint8_t file;
+} stats_counter_t;
+
+static stats_counter_t counters[STATS_MAX_COUNTERS];
+static int num_counters;
+static stats_text_fn texts[STATS_NUM_FILES];
+
+static const char *const dir_names[STATS_NUM_FILES] = {
+    "STATS   TXT",
+    "BANKS   TXT",
+    "FTL     TXT",
+    "BOOT    TXT",
+};
+
+void stats_counter(int file, const char *name, const volatile uint32_t *value) {
+    for (int i=0;i<num_counters;i++) {
+        if (counters[i].value == value) return; // registered on an earlier start
+    }
+    if (num_counters == STATS_MAX_COUNTERS) return;
+    counters[num_counters].name = name;
+    counters[num_counters].value = value;
+    counters[num_counters].file = file;
+    num_counters++;
+}
+
+void stats_text(int file, stats_text_fn text) {
+    texts[file] = text;
+}
+
+const char *stats_dir_name(int file) {
+    return dir_names[file];
+}
+
+int stats_format(int file, char *buf, int size) {
+    int len = 0;
+    for (int i=0;i<num_counters && len < size;i++) {
+        if (counters[i].file != file) continue;
+        len += snprintf(buf + len, size - len, "%-20s %u\r\n", counters[i].name, *counters[i].value);
+    }
+    if (texts[file] && len < size) len += texts[file](buf + len, size - len);
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,30 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Counter registry behind the read only text files in the root of the live drive. Modules keep
+// their own counters and register them once, nothing is formatted until a host reads a file.
+#define STATS_FILE_STATS    0   // STATS.TXT bus, latch and USB counters, clock and boot time
+#define STATS_FILE_BANKS    1   // BANKS.TXT where each ROM came from, its CRC and load time
+#define STATS_FILE_FTL      2   // FTL.TXT flash drive traffic, erases and write amplification
+#define STATS_FILE_BOOT     3   // BOOT.TXT time taken by each start up phase, see boottime.c
+#define STATS_NUM_FILES     4
+#define STATS_MAX_COUNTERS  28
+
+// extra lines after a file's counters, returns the length written
+typedef int (*stats_text_fn)(char *buf, int size);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void stats_counter(int file, const char *name, const volatile uint32_t *value);
+void stats_text(int file, stats_text_fn text);
+// 8.3 name as stored in a directory entry
+const char *stats_dir_name(int file);
+int stats_format(int file, char *buf, int size);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,193 @@
+// Bus trace capture
+// A PIO state machine on pio1 snapshots the GPIOs at every ROM read and latch write. A pair of
+// chained DMA channels copies each snapshot, then the microsecond timer, into two RAM rings, so
+// nothing runs on either core while capturing. Core 0 watches the rings for the trigger address
+// while it waits for latch bytes, and stops the DMA once the window has been captured.
+// The rings wrap about every millisecond, far more often than core 0 looks at them while it is
+// busy with USB or a command, so a third DMA channel counts the events: it refills the state
+// machine's TX FIFO, which the program pulls from once per event.
+#include <string.h>
+#include <ff.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "trace.pio.h"
+#include "picorom.h"
+#include "trace.h"
+
+#define DATA_BUS_GPIO       14
+#define ROMEN_GPIO          22
+#define A15_GPIO            26
+#define WRITE_LATCH_GPIO    27
+#define ADDR_MASK           0x3fff
+
+static PIO trace_pio = pio1;
+static uint trace_sm = 0;
+static int data_chan, time_chan, count_chan;
+static uint32_t count_word;         // what count_chan feeds the TX FIFO, never used
+static uint32_t trace_data[TRACE_EVENTS] __attribute__((aligned(TRACE_RING_BYTES)));
+static uint32_t trace_time[TRACE_EVENTS] __attribute__((aligned(TRACE_RING_BYTES)));
+
+static volatile trace_state_t state;
+static uint32_t seen;               // events checked by trace_poll
+static uint32_t stop_at;            // event count to stop at once triggered
+static uint32_t window;
+static uint16_t trigger_address;
+
+static inline uint32_t unrotate(uint32_t snapshot) {
+    return (snapshot << TRACE_GPIO_ROTATE) | (snapshot >> (32 - TRACE_GPIO_ROTATE));
+}
+
+void trace_init(void) {
+    data_chan = dma_claim_unused_channel(true);
+    time_chan = dma_claim_unused_channel(true);
+    count_chan = dma_claim_unused_channel(true);
+    uint offset = pio_add_program(trace_pio, &trace_program);
+    trace_program_init(trace_pio, trace_sm, offset, ROMEN_GPIO, WRITE_LATCH_GPIO);
+    state = TRACE_IDLE;
+}
+
+// number of events written since the capture started. count_chan's transfers give the events
+// the state machine has seen, which can be a few ahead of the snapshots in the ring, and the
+// ring position gives the written count modulo the ring size. Good for 2^32 - 1 events.
+static uint32_t __not_in_flash_func(trace_count)(void) {
+    // read in this order, so a refill or pull in between can only make pulled larger
+    uint32_t index = (dma_channel_hw_addr(data_chan)->write_addr - (uint32_t)trace_data) / 4;
+    uint32_t queued = pio_sm_get_tx_fifo_level(trace_pio, trace_sm);
+    uint32_t pulled = 0xffffffff - dma_channel_hw_addr(count_chan)->transfer_count - queued;
+    return pulled - ((pulled - index) % TRACE_EVENTS);
+}
+
+static void trace_stop(void) {
+    pio_sm_set_enabled(trace_pio, trace_sm, false);
+    // let snapshots already in the FIFO reach both rings before stopping
+    while (!pio_sm_is_rx_fifo_empty(trace_pio, trace_sm) || dma_channel_is_busy(time_chan)) tight_loop_contents();
+    dma_channel_abort(data_chan);
+    dma_channel_abort(time_chan);
+}
+
+void trace_start(int mode, uint32_t events, uint16_t address) {
+    if (state == TRACE_ARMED || state == TRACE_TRIGGERED) trace_stop();
+    window = events < TRACE_EVENTS ? events : TRACE_EVENTS;
+    trigger_address = address;
+    seen = 0;
+
+    dma_channel_config c = dma_channel_get_default_config(data_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, TRACE_RING_BITS);
+    channel_config_set_dreq(&c, pio_get_dreq(trace_pio, trace_sm, false));
+    channel_config_set_chain_to(&c, time_chan);
+    dma_channel_configure(data_chan, &c, trace_data, &trace_pio->rxf[trace_sm], 1, false);
+
+    c = dma_channel_get_default_config(time_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, TRACE_RING_BITS);
+    channel_config_set_chain_to(&c, data_chan);
+    dma_channel_configure(time_chan, &c, trace_time, &timer_hw->timerawl, 1, false);
+
+    dma_channel_abort(count_chan);
+    c = dma_channel_get_default_config(count_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(trace_pio, trace_sm, true));
+    dma_channel_configure(count_chan, &c, &trace_pio->txf[trace_sm], &count_word, 0xffffffff, false);
+
+    pio_sm_clear_fifos(trace_pio, trace_sm);
+    pio_sm_restart(trace_pio, trace_sm);
+    dma_channel_start(count_chan);
+    // the TX FIFO is full before the first event
+    while (!pio_sm_is_tx_fifo_full(trace_pio, trace_sm)) tight_loop_contents();
+    dma_channel_start(data_chan);
+    if (mode == TRACE_MODE_ADDRESS) {
+        state = TRACE_ARMED;
+    } else {
+        stop_at = window;
+        state = TRACE_TRIGGERED;
+    }
+    pio_sm_set_enabled(trace_pio, trace_sm, true);
+}
+
+void __not_in_flash_func(trace_poll)(void) {
+    if (state != TRACE_ARMED && state != TRACE_TRIGGERED) return;
+    uint32_t count = trace_count();
+    if (state == TRACE_ARMED) {
+        // events overwritten before we got here cannot trigger
+        if (count - seen > TRACE_EVENTS) seen = count - TRACE_EVENTS;
+        for (; seen < count; seen++) {
+            uint32_t gpio = unrotate(trace_data[seen % TRACE_EVENTS]);
+            if ((gpio & (1 << ROMEN_GPIO)) == 0 &&
+                (gpio & ADDR_MASK) == (trigger_address & ADDR_MASK) &&
+                ((gpio >> A15_GPIO) & 1) == (trigger_address >> 15)) {
+                stop_at = seen + window;
+                state = TRACE_TRIGGERED;
+                break;
+            }
+        }
+    }
+    if (state == TRACE_TRIGGERED && count >= stop_at) {
+        trace_stop();
+        state = TRACE_DONE;
+    }
+}
+
+trace_state_t trace_state(void) {
+    return state;
+}
+
+// VCD value changes for one snapshot
+static void write_vcd_event(FIL *fp, uint32_t ns, uint32_t gpio) {
+    char addr[15], data[9];
+    for (int i=0;i<14;i++) addr[i] = (gpio >> (13 - i)) & 1 ? '1' : '0';
+    addr[14] = 0;
+    for (int i=0;i<8;i++) data[i] = (gpio >> (DATA_BUS_GPIO + 7 - i)) & 1 ? '1' : '0';
+    data[8] = 0;
+    f_printf(fp, "#%u\nb%s a\n%ub\n%uc\nb%s d\n%ue\n", ns, addr, (gpio >> A15_GPIO) & 1,
+        (gpio >> ROMEN_GPIO) & 1, data, (gpio >> WRITE_LATCH_GPIO) & 1);
+}
+
+// Write the captured events, oldest first, to TRACE_BIN_FILE and TRACE_VCD_FILE.
+// Returns the number of events saved or -1 on error.
+int trace_save(void) {
+    if (state == TRACE_ARMED || state == TRACE_TRIGGERED) {
+        trace_stop();
+        state = TRACE_DONE;
+    }
+    if (state != TRACE_DONE) return 0;
+    uint32_t count = trace_count();
+    uint32_t events = count < TRACE_EVENTS ? count : TRACE_EVENTS;
+    uint32_t first = count - events;
+    FIL fp;
+    UINT bw;
+    if (f_open(&fp, TRACE_BIN_FILE, FA_CREATE_ALWAYS|FA_WRITE) != FR_OK) return -1;
+    f_expand(&fp, events * 8, 0);   // in one run of clusters if there is room
+    // time_us, gpio pairs
+    for (uint32_t i=first;i<count;i++) {
+        uint32_t rec[2] = { trace_time[i % TRACE_EVENTS], unrotate(trace_data[i % TRACE_EVENTS]) };
+        f_write(&fp, rec, sizeof(rec), &bw);
+    }
+    if (f_close(&fp) != FR_OK) return -1;
+
+    if (f_open(&fp, TRACE_VCD_FILE, FA_CREATE_ALWAYS|FA_WRITE) != FR_OK) return -1;
+    f_printf(&fp, "$timescale 1ns $end\n$scope module cpc $end\n"
+        "$var wire 14 a addr $end\n$var wire 1 b a15 $end\n$var wire 1 c romen_n $end\n"
+        "$var wire 8 d data $end\n$var wire 1 e write_latch $end\n"
+        "$upscope $end\n$enddefinitions $end\n");
+    // the timer only has microsecond resolution, so events in the same microsecond are
+    // spread 100ns apart and each strobe is shown released 50ns later
+    uint32_t t0 = events ? trace_time[first % TRACE_EVENTS] : 0;
+    uint32_t last_ns = 0;
+    for (uint32_t i=first;i<count;i++) {
+        uint32_t ns = (trace_time[i % TRACE_EVENTS] - t0) * 1000;
+        if (i != first && ns <= last_ns) ns = last_ns + 100;
+        write_vcd_event(&fp, ns, unrotate(trace_data[i % TRACE_EVENTS]));
+        f_printf(&fp, "#%u\n1c\n1e\n", ns + 50);
+        last_ns = ns;
+    }
+    if (f_close(&fp) != FR_OK) return -1;
+    return events;
+}
@@ -0,0 +1,34 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bus trace capture, built with TRACE_CAPTURE
+#define TRACE_BIN_FILE      "TRACE.BIN"
+#define TRACE_VCD_FILE      "TRACE.VCD"
+#ifndef TRACE_RING_BITS
+#define TRACE_RING_BITS     12              // log2 of ring size in bytes
+#endif
+#define TRACE_RING_BYTES    (1 << TRACE_RING_BITS)
+#define TRACE_EVENTS        (TRACE_RING_BYTES / 4)
+#define TRACE_GPIO_ROTATE   22              // snapshots start at ROMEN
+
+#define TRACE_MODE_SAVE     0
+#define TRACE_MODE_NOW      1
+#define TRACE_MODE_ADDRESS  2
+
+typedef enum { TRACE_IDLE, TRACE_ARMED, TRACE_TRIGGERED, TRACE_DONE } trace_state_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void trace_init(void);
+void trace_start(int mode, uint32_t window, uint16_t address);
+void trace_poll(void);
+trace_state_t trace_state(void);
+int trace_save(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -82,6 +82,7 @@ enum
   ITF_NUM_CDC = 0,
   ITF_NUM_CDC_DATA,
   ITF_NUM_MSC,
+  ITF_NUM_VENDOR,
   ITF_NUM_TOTAL
 };
 
@@ -95,6 +96,9 @@ enum
   #define EPNUM_MSC_OUT     0x05
   #define EPNUM_MSC_IN      0x85
 
+  #define EPNUM_VENDOR_OUT  0x08
+  #define EPNUM_VENDOR_IN   0x88
+
 #elif CFG_TUSB_MCU == OPT_MCU_SAMG  || CFG_TUSB_MCU ==  OPT_MCU_SAMX7X
   // SAMG & SAME70 don't support a same endpoint number with different direction IN and OUT
   //    e.g EP1 OUT & EP1 IN cannot exist together
@@ -105,6 +109,9 @@ enum
   #define EPNUM_MSC_OUT     0x04
   #define EPNUM_MSC_IN      0x85
 
+  #define EPNUM_VENDOR_OUT  0x06
+  #define EPNUM_VENDOR_IN   0x87
+
 #elif CFG_TUSB_MCU == OPT_MCU_CXD56
   // CXD56 doesn't support a same endpoint number with different direction IN and OUT
   //    e.g EP1 OUT & EP1 IN cannot exist together
@@ -117,6 +124,9 @@ enum
   #define EPNUM_MSC_OUT     0x05
   #define EPNUM_MSC_IN      0x84
 
+  #define EPNUM_VENDOR_OUT  0x08
+  #define EPNUM_VENDOR_IN   0x86
+
 #elif CFG_TUSB_MCU == OPT_MCU_FT90X || CFG_TUSB_MCU == OPT_MCU_FT93X
   // FT9XX doesn't support a same endpoint number with different direction IN and OUT
   //    e.g EP1 OUT & EP1 IN cannot exist together
@@ -127,6 +137,9 @@ enum
   #define EPNUM_MSC_OUT     0x04
   #define EPNUM_MSC_IN      0x85
 
+  #define EPNUM_VENDOR_OUT  0x06
+  #define EPNUM_VENDOR_IN   0x87
+
 #else
   #define EPNUM_CDC_NOTIF   0x81
   #define EPNUM_CDC_OUT     0x02
@@ -135,9 +148,12 @@ enum
   #define EPNUM_MSC_OUT     0x03
   #define EPNUM_MSC_IN      0x83
 
+  #define EPNUM_VENDOR_OUT  0x04
+  #define EPNUM_VENDOR_IN   0x84
+
 #endif
 
-#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MSC_DESC_LEN)
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MSC_DESC_LEN + TUD_VENDOR_DESC_LEN)
 
 // full speed configuration
 uint8_t const desc_fs_configuration[] =
@@ -150,6 +166,9 @@ uint8_t const desc_fs_configuration[] =
 
   // Interface number, string index, EP Out & EP In address, EP size
   TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 5, EPNUM_MSC_OUT, EPNUM_MSC_IN, 64),
+
+  // Interface number, string index, EP Out & EP In address, EP size
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 6, EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN, 64),
 };
 
 #if TUD_OPT_HIGH_SPEED
@@ -166,6 +185,9 @@ uint8_t const desc_hs_configuration[] =
 
   // Interface number, string index, EP Out & EP In address, EP size
   TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 5, EPNUM_MSC_OUT, EPNUM_MSC_IN, 512),
+
+  // Interface number, string index, EP Out & EP In address, EP size
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 6, EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN, 512),
 };
 
 // other speed configuration
@@ -245,6 +267,7 @@ char const* string_desc_arr [] =
   "123456789012",                // 3: Serials, should use chip ID
   "TinyUSB CDC",                 // 4: CDC Interface
   "TinyUSB MSC",                 // 5: MSC Interface
+  "PicoROM bulk",                // 6: Vendor Interface
 };
 
 static uint16_t _desc_str[32];
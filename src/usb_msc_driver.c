@@ -2,12 +2,20 @@
 #include <bsp/board.h>
 #include <tusb.h>
 #include "flash.h"
+#include "live.h"
 
 #ifndef MSC_DRIVER_DEBUG
 #define MSC_DRIVER_DEBUG 0
 #endif
 // whether host does safe-eject
 static bool ejected = false;
+// in CPC mode the drive is the live ROM volume rather than the flash drive
+static bool live = false;
+
+void msc_set_live(bool on) {
+    live = on;
+    ejected = false;
+}
 
 static void fatal(int flashes) {
     while(1) {
@@ -66,6 +74,11 @@ bool tud_msc_test_unit_ready_cb(uint8_t lun)
 void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size)
 {
     (void) lun;
+    if (live) {
+        *block_count = live_lba_count();
+        *block_size  = 512;
+        return;
+    }
     *block_count = get_lba_count();
     *block_size  = get_lba_size();
 }
@@ -79,9 +92,9 @@ bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, boo
     (void) power_condition;
 
     if (start && load_eject) {
-        flash_init();
+        if (!live) flash_init();
     } else if (!start && load_eject) {
-        flash_persist();
+        if (!live) flash_persist();
         ejected = true;
     }
     return true;
@@ -94,15 +107,20 @@ int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buff
     (void) lun;
     #if MSC_DRIVER_DEBUG
     printf("tud_msc_read10_cb(%d, %lu, %lu, buffer, %lu)\n", lun, lba, offset, bufsize);
-    if (offset != 0) printf("ERROR offset is not 0\n");
-    if (bufsize != get_lba_size()) printf("ERROR bufsize mismatch %d <> %d\n", bufsize, get_lba_size());
+    if (offset + bufsize > get_lba_size()) printf("ERROR offset + bufsize past the sector %d\n", get_lba_size());
     #endif
+    if (live) {
+        if (lba >= live_lba_count()) return -1;
+        live_read(lba, buffer);
+        return (int32_t) bufsize;
+    }
     // out of ramdisk
     if (lba >= get_lba_count()) {
         printf("read10 out of ramdisk: lba=%u\n", lba);
         return -1;
     }
-    flash_read(lba, buffer);
+    // with 4K sectors a sector comes in several parts of the endpoint buffer size
+    flash_read_part(lba, offset, buffer, bufsize);
 
     return (int32_t) bufsize;
 }
@@ -120,16 +138,20 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t*
     (void) lun;
     #if MSC_DRIVER_DEBUG
     printf("tud_msc_write10_cb(%d, %lu, %lu, buffer, %lu)\n", lun, lba, offset, bufsize);
-    if (offset != 0) printf("ERROR offset is not 0\n");
-    if (bufsize != get_lba_size()) printf("ERROR bufsize mismatch %d <> %d\n", bufsize, get_lba_size());
+    if (offset + bufsize > get_lba_size()) printf("ERROR offset + bufsize past the sector %d\n", get_lba_size());
     #endif
+    if (live) {
+        if (lba >= live_lba_count()) return -1;
+        live_write(lba, buffer);
+        return (int32_t) bufsize;
+    }
     // out of ramdisk
     if (lba >= get_lba_count()) {
         printf("write10 out of ramdisk: lba=%u\n", lba);
         return -1;
     }
 
-    flash_write(lba, buffer);
+    flash_write_part(lba, offset, buffer, bufsize);
     return (int32_t)bufsize;
 }
 
@@ -151,14 +173,16 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, u
     switch (scsi_cmd[0]) {
     case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
         // Host is about to read/write etc ... better not to disconnect disk
-        if (scsi_cmd[4] & 1) {
+        if ((scsi_cmd[4] & 1) && !live) {
             flash_init();
         }
         resplen = 0;
         break;
     case SCSI_CMD_START_STOP_UNIT:
         // Host try to eject/safe remove/poweroff us. We could safely disconnect with disk storage, or go into lower power
-        if (!start_stop->start && start_stop->load_eject) {
+        if (live) {
+            // nothing to persist, the live volume is RAM
+        } else if (!start_stop->start && start_stop->load_eject) {
             flash_persist();
         } else if (start_stop->start && start_stop->load_eject) {
             flash_init();
@@ -0,0 +1,78 @@
+// USB CDC command channel
+// A PC sends the same bytes picorom.s writes to the latch: CMD_PREFIX_BYTE, the command byte
+// and its parameters, and dispatch() runs it as if it came from the CPC. Each response is sent
+// back as <seq> <status> <type> <length> <data>, data being the response string without its
+// terminator. Anything before a prefix byte is discarded. If the PC stops sending in the middle
+// of a command, the rest of its parameters read as 0 without waiting and usbcmd_aborted() says
+// so, and a PC that stops reading loses the response rather than stalling the Pico.
+#include <string.h>
+#include <pico/stdlib.h>
+#include <tusb.h>
+#include "protocol.h"
+#include "usbcmd.h"
+
+static bool aborted;    // a parameter byte timed out, the command is abandoned
+
+// true when a command has started, the prefix byte has been read
+bool usbcmd_ready(void) {
+    if (!tud_cdc_connected()) return false;
+    while (tud_cdc_available()) {
+        if (tud_cdc_read_char() == CMD_PREFIX_BYTE) {
+            aborted = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+// next byte of the command, 0 once the PC has stopped sending
+uint32_t usbcmd_get(void) {
+    if (aborted) return 0;
+    absolute_time_t timeout = make_timeout_time_ms(USBCMD_TIMEOUT_MS);
+    while (!tud_cdc_available()) {
+        tud_task();
+        if (!tud_cdc_connected() || absolute_time_diff_us(timeout, get_absolute_time()) > 0) {
+            aborted = true;
+            return 0;
+        }
+    }
+    return tud_cdc_read_char() & 0xff;
+}
+
+bool usbcmd_aborted(void) {
+    return aborted;
+}
+
+// false if the PC didn't take it all within the timeout
+static bool write_all(const uint8_t *data, uint32_t len, absolute_time_t timeout) {
+    while (len) {
+        uint32_t n = tud_cdc_write(data, len);
+        data += n;
+        len -= n;
+        if (len) {
+            tud_cdc_write_flush();
+            tud_task();
+            if (!tud_cdc_connected() || absolute_time_diff_us(timeout, get_absolute_time()) > 0) return false;
+        }
+    }
+    return true;
+}
+
+void usbcmd_respond(const uint8_t *resp) {
+    uint8_t header[4];
+    uint32_t len = 0;
+    if (resp[RESP_TYPE] == 1) {
+        len = strnlen((const char *)&resp[RESP_DATA], 255);
+    }
+    header[0] = resp[RESP_SEQ];
+    header[1] = resp[RESP_STATUS];
+    header[2] = resp[RESP_TYPE];
+    header[3] = len;
+    absolute_time_t timeout = make_timeout_time_ms(USBCMD_TIMEOUT_MS);
+    if (!write_all(header, sizeof(header), timeout) || !write_all(&resp[RESP_DATA], len, timeout)) {
+        // don't leave half a response for the next one to follow
+        tud_cdc_write_clear();
+        return;
+    }
+    tud_cdc_write_flush();
+}
@@ -0,0 +1,15 @@
+#ifndef _USBCMD_H_
+#define _USBCMD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// response buffer for USB commands, as big as the debug text dispatch() writes after the response
+#define USBCMD_RESP_SIZE    0x200
+#define USBCMD_TIMEOUT_MS   1000    // gap allowed between parameter bytes, and to send a response
+
+bool usbcmd_ready(void);
+uint32_t usbcmd_get(void);
+bool usbcmd_aborted(void);
+void usbcmd_respond(const uint8_t *resp);
+#endif
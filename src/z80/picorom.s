@@ -16,6 +16,26 @@ CMD_ROMLIST2	EQU $FA
 CMD_ROMIN:		EQU $F9
 CMD_ROMOUT:		EQU $F8
 CMD_ROMSET:		EQU $F7
+CMD_PSAVE:		EQU $F6
+CMD_ROMFIND1	EQU $F5
+CMD_ROMFIND2	EQU $F4
+CMD_DIR1		EQU $F3
+CMD_DIR2		EQU $F2
+CMD_LOGFLUSH	EQU $F1
+CMD_PROFILE1	EQU $F0
+CMD_PROFILE2	EQU $EF
+CMD_PROFILE_CLR	EQU $EE
+CMD_LATENCY1	EQU $ED
+CMD_LATENCY2	EQU $EC
+CMD_LATENCY_CLR	EQU $EB
+CMD_CALIBRATE	EQU $EA
+CMD_TRACE		EQU $E9
+CMD_ROMDATA		EQU $E8		; USB only
+CMD_BOOT1		EQU $E7
+CMD_BOOT2		EQU $E6
+
+PSAVE_STATUS_OK		EQU 0
+PSAVE_STATUS_RETRY	EQU 2
 
 		org $c000
 		defb    1       ; background rom
@@ -31,6 +51,14 @@ CMD_ROMSET:		EQU $F7
 		jp ROMLIST
 		jp ROMOUT
 		jp ROMIN
+		jp PSAVE
+		jp ROMFIND
+		jp PLOG
+		jp PROFILE
+		jp LATENCY
+		jp PCAL
+		jp PTRACE
+		jp PBOOT
 
 NAME_TABLE:	
 		defm  "PICO RO",'M'+128
@@ -41,6 +69,14 @@ NAME_TABLE:
 		defm  "ROM", 'S'+128
 		defm  "ROMOU", 'T'+128
 		defm  "ROMI", 'N'+128
+		defm  "PSAV", 'E'+128
+		defm  "ROMFIN", 'D'+128
+		defm  "PLO", 'G'+128
+		defm  "PROFIL", 'E'+128
+		defm  "LATENC", 'Y'+128
+		defm  "PCA", 'L'+128
+		defm  "PTRAC", 'E'+128
+		defm  "PBOO", 'T'+128
 		defb    0
 INIT:	
 		push HL
@@ -75,6 +111,26 @@ START_MSG:
 		ret
 		ENDM
 
+; send a command with no parameters and display the response
+		MACRO CMD_0P cmd
+		LOCAL wait
+		ld hl, RESP_BUF
+		ld a, (hl)		; get current sequence number in A
+		ld BC, IO_PORT
+		out (c), c
+		ld c, cmd
+		out (c),c
+.wait
+		cp (hl)			; wait for the sequence number to be updated
+		jr z,wait
+		inc hl		; skip status code
+		inc hl		; skip data type
+		inc hl		; point to start of response
+		call disp_str
+		call cr_nl
+		ret
+		ENDM
+
 ;
 		MACRO CMD_0P_NOWAIT cmd
 		ld BC, IO_PORT 	; command prefix
@@ -85,14 +141,20 @@ START_MSG:
 		ENDM
 
 		MACRO LIST_COMMAND cmd1, cmd2
-		LOCAL wait, done ,nokey
-		ld d, 22		; number of lines to display
 		ld hl, RESP_BUF
 		ld a, (hl)		; get current sequence number in A
 		ld BC, IO_PORT 	; command prefix
 		out (c), c
 		ld C, cmd1 	; command byte
 		out (c), c
+		LIST_RESULTS cmd2
+		ENDM
+
+; display list results until the Pico reports the end of the list
+; HL = RESP_BUF, A = sequence number before the first command was sent
+		MACRO LIST_RESULTS cmd2
+		LOCAL wait, done ,nokey
+		ld d, 22		; number of lines to display
 .wait
 		cp (hl)			; wait for the sequence number to be updated
 		jr z, wait
@@ -135,9 +197,125 @@ IP_MSG:
 
 LED:		CMD_1P CMD_LED, IP_MSG
 BOOT:		CMD_0P_NOWAIT CMD_PICOLOAD
-ROMDIR:		LIST_COMMAND CMD_ROMDIR1, CMD_ROMDIR2
+PLOG:		CMD_0P CMD_LOGFLUSH
+
+PROFILE:	; |PROFILE lists bus access counts and writes PROFILE.CSV, |PROFILE,0 clears them
+		or	a
+		jr	nz, PROFILE_CLR
+		LIST_COMMAND CMD_PROFILE1, CMD_PROFILE2
+PROFILE_CLR:
+		CMD_0P CMD_PROFILE_CLR
+
+LATENCY:	; |LATENCY shows the ROMEN to data histogram and writes LATENCY.CSV, |LATENCY,0 clears it
+		or	a
+		jr	nz, LATENCY_CLR
+		LIST_COMMAND CMD_LATENCY1, CMD_LATENCY2
+LATENCY_CLR:
+		CMD_0P CMD_LATENCY_CLR
+
+PBOOT:		LIST_COMMAND CMD_BOOT1, CMD_BOOT2	; |PBOOT shows how long each start up phase took
+
+PCAL:		CMD_1P CMD_CALIBRATE, PC_U_MSG
+PC_U_MSG:
+		defm  " Usage |PCAL,<margin ns>",0x0d,0x0a,0x0d,0x0a,0x00
+ROMDIR:	; |PDIR lists the ROM index, |PDIR,<path>[,<sort>[,<page>]] browses a directory
+		or	a
+		jp	z, PD_INDEX
+		cp	4
+		jp	nc, PD_USAGE
+		ld	DE, $FF00	; D = page (all), E = sort (name)
+		cp	1
+		jr	z, PD_1
+		cp	2
+		jr	z, PD_2
+		ld	D,(IX+0)	; page
+		ld	E,(IX+2)	; sort
+		ld	L,(IX+4)
+		ld	H,(IX+5)	; HL = string descriptor
+		jr	PD_SEND
+PD_2:
+		ld	E,(IX+0)	; sort
+		ld	L,(IX+2)
+		ld	H,(IX+3)	; HL = string descriptor
+		jr	PD_SEND
+PD_1:
+		ld	L,(IX+0)
+		ld	H,(IX+1)	; HL = string descriptor
+PD_SEND:
+		ld	A,(RESP_BUF)
+		push AF			; save current sequence number
+		ld	BC, IO_PORT	; command prefix
+		out	(c), c
+		ld	C, CMD_DIR1
+		out	(c), c
+		out	(c), e		; sort
+		out	(c), d		; page
+		ld	A,(HL)
+		out	(c), a		; length
+		or	A
+		jr	z, PD_SENT	; empty path = root
+		inc	HL
+		ld	E,(HL)
+		inc	HL
+		ld	D,(HL)
+		ex	DE, HL		; string address now in HL
+PD_LOOP:
+		ld	c,(HL)
+		out	(c),C
+		inc	HL
+		dec	A
+		jr	nz,	PD_LOOP
+PD_SENT:
+		pop	AF
+		ld	HL, RESP_BUF
+		LIST_RESULTS CMD_DIR2
+PD_INDEX:	LIST_COMMAND CMD_ROMDIR1, CMD_ROMDIR2
+PD_USAGE:
+		ld hl, PD_U_MSG
+		call disp_str
+		ret
+PD_U_MSG:
+		defm  " Usage |PDIR[,<path>[,<sort>[,<page>]]]",0x0d,0x0a,0x0d,0x0a,0x00
 ROMLIST:	LIST_COMMAND CMD_ROMLIST1, CMD_ROMLIST2
 
+ROMFIND:	; search the ROM index by file or RSX name
+		cp	1
+		jr	nz, RF_USAGE
+		ld	L,(IX+0)
+		ld	H,(IX+1)	; HL = string descriptor
+		ld	A,(HL)		; length
+		or	A
+		jr	z, RF_USAGE
+
+		ld	A,(RESP_BUF)
+		push AF			; save current sequence number
+		ld	BC, IO_PORT	; command prefix
+		out	(c), c
+		ld	C, CMD_ROMFIND1
+		out	(c), c
+		ld	A,(HL)
+		out	(c), a		; length
+		inc	HL
+		ld	E,(HL)
+		inc	HL
+		ld	D,(HL)
+		ex	DE, HL		; string address now in HL
+RF_LOOP:
+		ld	c,(HL)
+		out	(c),C
+		inc	HL
+		dec	A
+		jr	nz,	RF_LOOP
+		pop	AF
+		ld	HL, RESP_BUF
+		LIST_RESULTS CMD_ROMFIND2
+RF_USAGE:
+		ld hl, RF_U_MSG
+		call disp_str
+		ret
+RF_U_MSG:
+		defm  " Usage |ROMFIND,<text>",0x0d,0x0a,0x0d,0x0a,0x00
+
 		MACRO WAIT_FOR_COMPLETION
 		; wait for command to finish. Last seq value in A
 		; display the result
@@ -251,6 +429,191 @@ RS_DONE:
 RS_U_MSG:
 		defm  " Usage |ROMSET,<CONFIG>",0x0d,0x0a,0x0d,0x0a,0x00
 
+PSAVE:	; save memory to a file on the Pico - |PSAVE,"file",addr,len
+		cp	3
+		jp	nz, PS_USAGE
+		ld	E,(IX+0)
+		ld	D,(IX+1)	; DE = length
+		ld	A,D
+		or	E
+		jp	z, PS_USAGE
+		ld	L,(IX+4)
+		ld	H,(IX+5)	; HL = string descriptor
+		ld	A,(HL)		; length
+		or	A
+		jp	z, PS_USAGE
+
+		push DE
+		ld	A,(RESP_BUF)
+		push AF			; save current sequence number
+		ld	BC, IO_PORT	; command prefix
+		out	(c), c
+		ld	C, CMD_PSAVE
+		out	(c), c
+		ld	A,(HL)
+		out	(c), a		; name length
+		inc	HL
+		ld	E,(HL)
+		inc	HL
+		ld	D,(HL)
+		ex	DE, HL		; string address now in HL
+PS_NAME:
+		ld	c,(HL)
+		out	(c),C
+		inc	HL
+		dec	A
+		jr	nz,	PS_NAME
+		pop	AF			; sequence number
+		pop	DE			; length
+		out	(c), e
+		out	(c), d
+		ld	L,(IX+2)
+		ld	H,(IX+3)	; HL = start address
+		call PS_WAIT	; wait for file to be opened
+		jr	nz, PS_RESULT
+
+; send frames of up to 256 bytes, each followed by a CRC
+; HL = data, DE = bytes remaining
+PS_FRAME:
+		push DE			; remaining
+		push HL			; frame start, in case we need to resend
+		ld	C,E			; bytes in this frame, 0 = 256
+		ld	A,D
+		or	A
+		jr	z, PS_SHORT
+		ld	C,0
+PS_SHORT:
+		ld	B, IO_PORT/256
+		ld	DE, $FFFF	; CRC
+PS_BYTE:
+		ld	A,(HL)
+		out	(c),a
+		call crc16
+		inc	HL
+		dec	C
+		jr	nz, PS_BYTE
+		ld	A,(RESP_BUF)
+		ld	C,A			; sequence number
+		out	(c),e		; CRC lo
+		out	(c),d		; CRC hi
+		ld	A,C
+		call PS_WAIT
+		jr	z, PS_OK
+		cp	PSAVE_STATUS_RETRY
+		jr	nz, PS_FAIL
+		pop	HL			; back to frame start
+		pop	DE
+		jr	PS_FRAME
+PS_FAIL:
+		pop	HL
+		pop	DE
+		jr	PS_RESULT
+PS_OK:
+		pop	DE			; discard frame start
+		pop	DE			; remaining
+		ld	A,D
+		or	A
+		jr	z, PS_RESULT	; that was the last frame
+		dec	D
+		ld	A,D
+		or	E
+		jr	nz, PS_FRAME
+PS_RESULT:
+		ld	HL, RESP_BUF+3
+		call disp_str
+		call cr_nl
+		ret
+PS_USAGE:
+		ld hl, PS_U_MSG
+		call disp_str
+		ret
+PS_U_MSG:
+		defm  " Usage |PSAVE,<file>,<address>,<length>",0x0d,0x0a,0x0d,0x0a,0x00
+
+PS_WAIT: ; wait for sequence number to change from A, return status in A, Z set if OK
+		push HL
+		ld	HL, RESP_BUF
+PS_WAIT1:
+		cp	(HL)
+		jr	z, PS_WAIT1
+		inc	HL
+		ld	A,(HL)
+		pop	HL
+		or	A
+		ret
+
+PTRACE:	; |PTRACE,<window> starts a trace, |PTRACE,<window>,<address> waits for the address,
+		; |PTRACE saves TRACE.BIN and TRACE.VCD
+		cp	3
+		jr	nc, PT_USAGE
+		ld	HL, 0		; window, 0 for the default
+		ld	DE, 0		; trigger address
+		or	a
+		jr	z, PT_SEND
+		cp	1
+		jr	z, PT_1
+		ld	E,(IX+0)
+		ld	D,(IX+1)	; address
+		ld	L,(IX+2)
+		ld	H,(IX+3)	; window
+		jr	PT_SEND
+PT_1:
+		ld	L,(IX+0)
+		ld	H,(IX+1)	; window
+PT_SEND:	; A = mode
+		ld	B, A
+		ld	A, (RESP_BUF)
+		push AF			; sequence number
+		ld	A, B
+		ld	BC, IO_PORT
+		out	(c), c
+		ld	C, CMD_TRACE
+		out	(c), c
+		out	(c), a		; mode
+		out	(c), l
+		out	(c), h		; window
+		out	(c), e
+		out	(c), d		; address
+		pop	AF
+		WAIT_FOR_COMPLETION
+		ret
+PT_USAGE:
+		ld hl, PT_U_MSG
+		call disp_str
+		ret
+PT_U_MSG:
+		defm  " Usage |PTRACE[,<window>[,<address>]]",0x0d,0x0a,0x0d,0x0a,0x00
+
+crc16:	; update CRC-16/CCITT in DE with byte in A. Uses A, preserves BC, HL
+		xor	D
+		ld	D,A
+		rrca
+		rrca
+		rrca
+		rrca
+		and	$0F
+		xor	D
+		ld	D,A
+		rrca
+		rrca
+		rrca
+		push AF
+		and	$1F
+		xor	E
+		ld	E,A
+		pop	AF
+		push AF
+		rrca
+		and	$F0
+		xor	E
+		ld	E,A
+		pop	AF
+		and	$E0
+		xor	D
+		ld	D,E
+		ld	E,A
+		ret
+
 cr_nl:
 		push af
 		ld A, 0x0d